@@ -9,6 +9,17 @@ and do some other magic to make everything work and compile under FreeRTOS.
 #define GDBSTUB_FREERTOS 1
 #endif
 
+/*
+FreeRTOS settings the thread support needs to walk the task lists: configMAX_PRIORITIES and
+configMAX_TASK_NAME_LEN from FreeRTOSConfig.h. The defaults are the values of the ESP8266 RTOS SDK.
+*/
+#ifndef GDBSTUB_FREERTOS_PRIORITIES
+#define GDBSTUB_FREERTOS_PRIORITIES 15
+#endif
+#ifndef GDBSTUB_FREERTOS_TASK_NAME_LEN
+#define GDBSTUB_FREERTOS_TASK_NAME_LEN 16
+#endif
+
 /*
 Enable this to make the exception and debugging handlers switch to a private stack. This will use 
 up 1K of RAM, but may be useful if you're debugging stack or stack pointer corruption problems. It's
@@ -29,6 +40,18 @@ the gdbstub_init call.
 #define GDBSTUB_CTRLC_BREAK 1
 #endif
 
+/*
+Size of the buffer for serial data the program receives. With GDBSTUB_CTRLC_BREAK, the stub takes over the
+UART interrupt; if this is not 0, received chars that aren't control-C or gdb packets are put in this
+buffer, and the program can read them with gdbstub_uart_read(). If the program doesn't keep up, chars are
+dropped and counted in gdbstub_uart_rx_dropped. Has to be a power of two. Data that only looks like a gdb
+packet is passed on as well. While gdb isn't attached, a '$' doesn't start a packet at all, so to attach gdb
+to a program that's already running, send a control-C over the serial port first.
+*/
+#ifndef GDBSTUB_UART_RX_BUF_SIZE
+#define GDBSTUB_UART_RX_BUF_SIZE 0
+#endif
+
 /*
 Enabling this will redirect console output to GDB. This basically means that printf/os_printf output 
 will show up in your gdb session, which is useful if you use gdb to do stuff. It also means that if
@@ -38,6 +61,16 @@ you use a normal terminal, you can't read the printfs anymore.
 #define GDBSTUB_REDIRECT_CONSOLE_OUTPUT 1
 #endif
 
+/*
+Size of the buffer redirected console output goes into. Printing only copies the characters into this
+buffer; they are sent to gdb in the background by the UART TX interrupt (or, without GDBSTUB_CTRLC_BREAK,
+when there's room in the UART FIFO), so printf doesn't stall the program anymore. If the buffer is full,
+characters are dropped and counted in gdbstub_console_dropped. Has to be a power of two.
+*/
+#ifndef GDBSTUB_CONSOLE_BUF_SIZE
+#define GDBSTUB_CONSOLE_BUF_SIZE 256
+#endif
+
 /*
 Enable this if you want the GDB stub to wait for you to attach GDB before running. It does this by
 breaking in the init routine; use the gdb 'c' command (continue) to start the program.
@@ -46,6 +79,112 @@ breaking in the init routine; use the gdb 'c' command (continue) to start the pr
 #define GDBSTUB_BREAK_ON_INIT 1
 #endif
 
+/*
+Size of the buffer incoming GDB packets are stored in. GDB is told it can send packets up to this size,
+and it will split memory reads and writes accordingly: with a bigger buffer, dumping memory or loading
+code takes a lot fewer round trips. The buffer lives in DRAM, so it costs this many bytes of RAM.
+Supported values are 256 to 4096.
+*/
+#ifndef GDBSTUB_PACKET_SIZE
+#define GDBSTUB_PACKET_SIZE 1024
+#endif
+
+/*
+Number of software breakpoints the stub can keep track of. The stub inserts and removes the BREAK
+instructions for these itself, and steps over them when the program resumes, so they can stay in place
+while the program is stopped. Each breakpoint takes 16 bytes of RAM, including where its condition is
+kept. Like any software breakpoint, they only work for code in RAM; the stub's memory map tells gdb which
+code is in flash, and gdb sets a hardware breakpoint there by itself.
+*/
+#ifndef GDBSTUB_SW_BREAKPOINTS
+#define GDBSTUB_SW_BREAKPOINTS 16
+#endif
+
+/*
+Size of the buffer that holds breakpoint conditions. If the condition of a breakpoint can be evaluated
+on the target, gdb sends it along with the breakpoint as bytecode, and the stub checks it every time the
+breakpoint is hit. The program only stops if the condition is true, which is a lot faster than a round
+trip to gdb for every hit. A simple condition takes about 10 bytes.
+*/
+#ifndef GDBSTUB_BP_COND_SIZE
+#define GDBSTUB_BP_COND_SIZE 256
+#endif
+
+/*
+Size of the trace buffer, in bytes. If this is not 0, gdb tracepoints ('trace', 'actions', 'tstart') are
+supported: every time the program passes a tracepoint, the stub stores the registers and memory gdb asked
+for in this buffer and lets the program continue, without waiting for gdb. Look at the results with 'tfind'
+afterwards. Tracepoints use a BREAK instruction in RAM, or the hardware breakpoint for code in flash, so
+they only cost a few dozen microseconds per hit. Has to be a power of two.
+*/
+#ifndef GDBSTUB_TRACE_BUF_SIZE
+#define GDBSTUB_TRACE_BUF_SIZE 0
+#endif
+
+/*
+Enable this to let gdb 'load' write the parts of the program that live in flash, so you can try a change
+without leaving gdb to run esptool. Sectors that didn't change aren't rewritten. Only the first MB of flash,
+which is mapped at 0x40200000, can be written this way. Note that the IRAM and DRAM parts are only loaded
+into RAM, not into the boot image at the start of flash: the program is only consistent until the chip
+resets, after which the new flash code runs with the old IRAM code. Flash the image with esptool before
+that. This uses 4K of RAM for a sector buffer.
+*/
+#ifndef GDBSTUB_FLASH_WRITE
+#define GDBSTUB_FLASH_WRITE 0
+#endif
+
+/*
+Size of the profiler histogram, in entries. If this is not 0, 'monitor prof start' makes the FRC1 timer
+interrupt sample the PC and caller of the running code; 'monitor prof dump' shows how often each was seen,
+and tools/gdbstub-profile.py turns that into a flat profile or flame graph input. Each entry is a different
+PC/caller combination and takes 12 bytes of RAM. Has to be a power of two. The timer can't be used by the
+program (e.g. for hw_timer or PWM) while profiling, and code that runs with interrupts disabled isn't seen.
+*/
+#ifndef GDBSTUB_PROFILE_SIZE
+#define GDBSTUB_PROFILE_SIZE 0
+#endif
+
+/*
+If this is not 0, a fatal exception while gdb isn't attached doesn't leave the stub waiting for gdb until
+the watchdog resets the chip. Instead, the registers and the contents of DRAM are saved to flash at this
+address, and the chip is reset right away. GDBSTUB_COREDUMP_SIZE bytes of flash are used, which has to be a
+multiple of the 4K sector size; 100K holds all of DRAM, with less the stack and as much of the rest of DRAM
+as fits are saved. Make sure nothing else uses that part of the flash.
+*/
+#ifndef GDBSTUB_COREDUMP_ADDR
+#define GDBSTUB_COREDUMP_ADDR 0
+#endif
+#ifndef GDBSTUB_COREDUMP_SIZE
+#define GDBSTUB_COREDUMP_SIZE 0x19000
+#endif
+
+/*
+Enable this to have the stub count what goes over the serial port, checksum errors, and how long commands
+and stops take. 'monitor stats' shows the counters, 'monitor stats reset' clears them. Useful to find out
+why a debug session is slow. When disabled, none of the counting code is compiled in.
+*/
+#ifndef GDBSTUB_STATS
+#define GDBSTUB_STATS 0
+#endif
+
+/*
+How long the File-I/O calls (gdbstub_open etc.) wait for gdb to answer, in milliseconds. If nothing comes
+in for this long, gdb is assumed to be gone and the call fails. Set this to 0 to wait forever, e.g. if you
+read from gdb's console (fd 0), where gdb waits for you to type something.
+*/
+#ifndef GDBSTUB_FILEIO_TIMEOUT_MS
+#define GDBSTUB_FILEIO_TIMEOUT_MS 10000
+#endif
+
+/*
+After 'monitor baud N' switches the serial port to a different speed, the stub goes back to the old
+speed if gdb doesn't send a valid packet at the new one within this many milliseconds. That gives you
+time to reconnect gdb at the new speed, while a bad speed won't lock you out.
+*/
+#ifndef GDBSTUB_BAUD_FALLBACK_MS
+#define GDBSTUB_BAUD_FALLBACK_MS 10000
+#endif
+
 /*
 Function attributes for function types.
 Gdbstub functions are placed in flash or IRAM using attributes, as defined here. The gdbinit function
@@ -55,6 +55,7 @@ also sets up some function pointers for ROM functions that aren't in the FreeRTO
 #include <stdio.h>
 void _xt_isr_attach(int inum, void *fn);
 void _xt_isr_unmask(int inum);
+void _xt_isr_mask(int inum);
 void os_install_putc1(void (*p)(char c));
 #define os_printf(...) printf(__VA_ARGS__)
 #define os_memcpy(a,b,c) memcpy(a,b,c)
@@ -75,8 +76,22 @@ int os_printf_plus(const char *format, ...)  __attribute__ ((format (printf, 1,
 
 #endif
 
+#if GDBSTUB_COREDUMP_ADDR || GDBSTUB_FLASH_WRITE
+#include "spi_flash.h"
+#endif
+
 #define EXCEPTION_GDB_SP_OFFSET 0x100
 
+//Timer registers, for the profiler.
+#define ETS_FRC_TIMER1_INUM 9
+#define REG_FRC1_LOAD 0x60000600
+#define REG_FRC1_CTRL 0x60000608
+#define REG_FRC1_INT 0x6000060c
+#define REG_EDGE_INT_ENABLE 0x3ff00004
+#define FRC1_CTRL_ENABLE BIT(7)
+#define FRC1_CTRL_AUTOLOAD BIT(6)
+#define FRC1_CTRL_DIV16 (1<<2)
+#define FRC1_CLK (80000000/16)
 
 //We need some UART register defines.
 #define ETS_UART_INUM 5
@@ -93,15 +108,45 @@ int os_printf_plus(const char *format, ...)  __attribute__ ((format (printf, 1,
 #define UART_RXFIFO_FULL_INT_ENA            (BIT(0))
 #define UART_RXFIFO_TOUT_INT_CLR            (BIT(8))
 #define UART_RXFIFO_FULL_INT_CLR            (BIT(0))
+#define UART_INT_ST(i)                  (REG_UART_BASE(i) + 0x8)
+#define UART_CONF1(i)                   (REG_UART_BASE(i) + 0x24)
+#define UART_TXFIFO_EMPTY_INT_ENA           (BIT(1))
+#define UART_TXFIFO_EMPTY_INT_ST            (BIT(1))
+#define UART_TXFIFO_EMPTY_INT_CLR           (BIT(1))
+#define UART_TXFIFO_EMPTY_THRHD             0x0000007F
+#define UART_TXFIFO_EMPTY_THRHD_S           8
+#define UART_CLKDIV(i)                  (REG_UART_BASE(i) + 0x14)
+#define UART_CLKDIV_CNT                     0x000FFFFF
+#define UART_CLK_FREQ                       80000000
+
+//Free-running microsecond counter
+#define WDEV_NOW()                      READ_PERI_REG(0x3ff20c00)
 
 
 
 
 //Length of buffer used to reserve GDB commands. Has to be at least able to fit the G command, which
 //implies a minimum size of about 190 bytes.
-#define PBUFLEN 256
-//Length of gdb stdout buffer, for console redirection
+#define PBUFLEN GDBSTUB_PACKET_SIZE
+#if PBUFLEN<256 || PBUFLEN>4096
+#error GDBSTUB_PACKET_SIZE should be between 256 and 4096
+#endif
+//Amount of console output that is gathered before it is sent to gdb, if no \n comes earlier
 #define OBUFLEN 32
+#if (GDBSTUB_CONSOLE_BUF_SIZE&(GDBSTUB_CONSOLE_BUF_SIZE-1))!=0
+#error GDBSTUB_CONSOLE_BUF_SIZE should be a power of two
+#endif
+//Received serial data is only passed on to the program if we have the UART interrupt.
+#if !GDBSTUB_CTRLC_BREAK
+#undef GDBSTUB_UART_RX_BUF_SIZE
+#define GDBSTUB_UART_RX_BUF_SIZE 0
+#endif
+#if (GDBSTUB_UART_RX_BUF_SIZE&(GDBSTUB_UART_RX_BUF_SIZE-1))!=0
+#error GDBSTUB_UART_RX_BUF_SIZE should be a power of two
+#endif
+#if (GDBSTUB_PROFILE_SIZE&(GDBSTUB_PROFILE_SIZE-1))!=0
+#error GDBSTUB_PROFILE_SIZE should be a power of two
+#endif
 
 //The asm stub saves the Xtensa registers here when a debugging exception happens.
 struct XTensa_exception_frame_s gdbstub_savedRegs;
@@ -112,11 +157,93 @@ int exceptionStack[256];
 
 static unsigned char cmd[PBUFLEN];		//GDB command input buffer
 static char chsum;						//Running checksum of the output packet
+static char rleChar;					//Char the current run in the output packet consists of
+static int rleCount=0;					//Length of that run
 #if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
-static unsigned char obuf[OBUFLEN];		//GDB stdout buffer
-static int obufpos=0;					//Current position in the buffer
+static unsigned char obuf[GDBSTUB_CONSOLE_BUF_SIZE]; //GDB stdout ring buffer
+static volatile unsigned int obufHead=0;	//Chars ever put in obuf. Only changed by gdb_semihost_putchar1.
+static volatile unsigned int obufTail=0;	//Chars ever sent from obuf. Only changed by gdbConsoleDrain.
+uint32_t gdbstub_console_dropped=0;		//Console chars thrown away because obuf was full
 #endif
+#if GDBSTUB_UART_RX_BUF_SIZE
+static unsigned char ibuf[GDBSTUB_UART_RX_BUF_SIZE]; //Received chars for the program
+static volatile unsigned int ibufHead=0;	//Chars ever put in ibuf. Only changed by the UART interrupt.
+static volatile unsigned int ibufTail=0;	//Chars ever read from ibuf. Only changed by gdbstub_uart_read.
+static unsigned int ibufPend=0;			//Like ibufHead, but includes the chars of a packet that may be for us
+static void (*ibufCallback)(void);		//Called when there's new data in ibuf
+#endif
+uint32_t gdbstub_uart_rx_dropped=0;		//Received chars thrown away because ibuf was full
 static int32_t singleStepPs=-1;			//Stores ps when single-stepping instruction. -1 when not in use.
+static int noAckMode=0;					//Set when gdb asked us to stop sending and expecting +/- acks
+static int transportCtrlC=0;			//gdbstub_transport_ctrlc is stopping the program
+static uint32_t baudFallbackDiv=0;		//UART divider to go back to if gdb doesn't show up after a baud change
+static uint32_t baudFallbackTime;		//WDEV_NOW() time at which to do that
+
+//The conditions gdb attached to a breakpoint. These are agent expressions (see 'Agent Expressions' in
+//the gdb manual), stored in condBuf as a 2-byte length followed by the bytecode.
+struct bpcond {
+	uint16_t off;						//Offset of the first expression in condBuf
+	uint16_t len;						//Total length of the expressions, 0 if there's no condition
+};
+
+//A software breakpoint, as set by gdb with Z0 or for a tracepoint.
+struct swbreakpoint {
+	uint32_t addr;						//Address of the breakpoint, 0 if this entry is unused
+	unsigned char len;					//Length of the instruction: 3 for BREAK, 2 for BREAK.N
+	unsigned char orig[3];				//The instruction bytes the BREAK replaced
+	unsigned char flags;				//What the breakpoint is used for: BP_GDB and/or BP_TRACE
+	struct bpcond cond;					//Condition for stopping at it, if it's a BP_GDB one
+};
+
+//Ignore count, as set with 'monitor ignore'. These are kept apart from the breakpoints because gdb
+//takes those out and puts them back every time the program stops.
+struct bpignore {
+	uint32_t addr;						//Address of the breakpoint, 0 if this entry is unused
+	uint32_t count;						//Number of hits still to ignore
+};
+
+#define BP_GDB 1						//Breakpoint flag: gdb wants us to stop here
+#define BP_TRACE 2						//Breakpoint flag: there's a tracepoint here
+#define BP_HW -2						//stepOverBp value for the hardware breakpoint
+#define BPIGNORELEN 4					//Amount of breakpoints that can have an ignore count
+
+static struct swbreakpoint swBreakpoints[GDBSTUB_SW_BREAKPOINTS];
+static uint32_t hwBpAddr;				//Address of the hardware breakpoint, 0 if none is set
+static int hwBpFlags;					//BP_GDB and/or BP_TRACE
+static struct bpcond hwBpCond;			//Condition for stopping at the hardware breakpoint
+static unsigned char condBuf[GDBSTUB_BP_COND_SIZE];	//Breakpoint condition bytecode
+static int condBufUsed;					//Bytes of condBuf in use
+static struct bpignore bpIgnore[BPIGNORELEN];
+static int stepOverBp=-1;				//Breakpoint taken out to step over it, BP_HW or -1 if none
+static int stepOverCont;				//Continue after the step over the breakpoint instead of stopping
+static uint32_t rangeStart, rangeEnd;	//Range we're stepping through for vCont;r, rangeEnd=0 if none
+static uint32_t watchAddr;				//Address of the hardware watchpoint
+static char watchType;					//Z packet type of the watchpoint: '2' write, '3' read, '4' access
+static int gdbAttached;					//Gdb has talked to us and hasn't detached
+static int fileIoBusy;					//A File-I/O request is going on
+static int fileIoResult;				//Return code from the F reply of gdb
+static int fileIoErrno;					//Errno from the F reply, if fileIoResult is -1
+static int fileIoCtrlC;					//Gdb got a control-C during the request
+static uint32_t recvTimeout;			//If not 0, gdbRecvChar gives up after this many us without a char
+
+#if GDBSTUB_STATS
+//Counters for 'monitor stats'. Times are in microseconds.
+#define STATS_BUCKETS 6					//Halt time histogram: <1ms, <10ms, <100ms, <1s, <10s, longer
+struct gdbstats {
+	uint32_t bytesRx, bytesTx;			//Bytes over the serial port, in both directions
+	uint32_t pktsRx, pktsTx;			//Valid packets received and packets sent
+	uint32_t badChsum;					//Packets received with a bad checksum, nacked with '-'
+	uint32_t naksRx;					//Nacks received from gdb
+	uint32_t cmdTime, cmdMax;			//Time spent handling commands, total and for the slowest one
+	uint32_t stops;						//Times the program stopped for gdb
+	uint32_t haltTime, haltMax;			//Time (ms) the program was stopped, total and for the longest stop
+	uint32_t haltHist[STATS_BUCKETS];	//Stops by how long they took
+};
+static struct gdbstats gdbStats;
+#define STATS_ADD(field, n) gdbStats.field+=(n)
+#else
+#define STATS_ADD(field, n) do {} while(0)
+#endif
 
 //Small function to feed the hardware watchdog. Needed to stop the ESP from resetting
 //due to a watchdog timeout while reading a command.
@@ -128,37 +255,105 @@ static void ATTR_GDBFN keepWDTalive() {
 	*wdtctl|=(1<<31);
 }
 
-//Receive a char from the uart. Uses polling and feeds the watchdog.
+//The UART0 transport, which is the default one.
+static int ATTR_GDBFN gdbUart0Poll() {
+	return (READ_PERI_REG(UART_STATUS(0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
+}
+
+static int ATTR_GDBFN gdbUart0Recv() {
+	return READ_PERI_REG(UART_FIFO(0))&0xFF;
+}
+
+static void ATTR_GDBFN gdbUart0Send(char c) {
+	while (((READ_PERI_REG(UART_STATUS(0))>>UART_TXFIFO_CNT_S)&UART_TXFIFO_CNT)>=126) ;
+	WRITE_PERI_REG(UART_FIFO(0), c);
+}
+
+//The UART sends by itself, so this only has to wait until the TX FIFO is empty.
+static void ATTR_GDBFN gdbUart0Flush() {
+	while (((READ_PERI_REG(UART_STATUS(0))>>UART_TXFIFO_CNT_S)&UART_TXFIFO_CNT)!=0) ;
+}
+
+static const struct gdbstub_transport gdbUart0Transport={
+	gdbUart0Poll, gdbUart0Recv, gdbUart0Send, gdbUart0Flush
+};
+static const struct gdbstub_transport *transport=&gdbUart0Transport;
+
+//Receive a char from gdb. Uses polling and feeds the watchdog. Returns -1 if recvTimeout is set and
+//nothing came in for that long.
 static int ATTR_GDBFN gdbRecvChar() {
 	int i;
-	while (((READ_PERI_REG(UART_STATUS(0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT)==0) {
-		keepWDTalive();
+	uint32_t t;
+	if (transport->poll()==0) {
+		//We're going to wait for gdb, so whatever we sent has to go out now.
+		transport->flush();
+		t=WDEV_NOW();
+		while (transport->poll()==0) {
+			keepWDTalive();
+			if (recvTimeout!=0 && WDEV_NOW()-t>recvTimeout) return -1;
+			if (baudFallbackDiv!=0 && (int32_t)(WDEV_NOW()-baudFallbackTime)>0) {
+				//No valid packet at the new baud rate in time. Go back to the old one.
+				WRITE_PERI_REG(UART_CLKDIV(0), baudFallbackDiv);
+				baudFallbackDiv=0;
+			}
+		}
 	}
-	i=READ_PERI_REG(UART_FIFO(0));
+	i=transport->recv();
+	STATS_ADD(bytesRx, 1);
 	return i;
 }
 
-//Send a char to the uart.
+//Send a char to gdb.
 static void ATTR_GDBFN gdbSendChar(char c) {
-	while (((READ_PERI_REG(UART_STATUS(0))>>UART_TXFIFO_CNT_S)&UART_TXFIFO_CNT)>=126) ;
-	WRITE_PERI_REG(UART_FIFO(0), c);
+	transport->send(c);
+	STATS_ADD(bytesTx, 1);
 }
 
 //Send the start of a packet; reset checksum calculation.
 static void ATTR_GDBFN gdbPacketStart() {
 	chsum=0;
+	rleCount=0;
 	gdbSendChar('$');
 }
 
+//Send a char as part of a packet, as-is.
+static void ATTR_GDBFN gdbPacketRawChar(char c) {
+	gdbSendChar(c);
+	chsum+=c;
+}
+
+//Send the run of identical chars gdbPacketChar gathered. Runs of 4 or more are run-length encoded as
+//the char, a '*' and the repeat count+29. The count can't be more than '~'-29, and counts that would
+//encode as '#' or '$' aren't allowed; those are sent as a shorter run plus the leftover chars.
+static void ATTR_GDBFN gdbPacketFlushRun() {
+	int n;
+	while (rleCount>0) {
+		gdbPacketRawChar(rleChar);
+		n=rleCount-1;
+		if (n>'~'-29) n='~'-29;
+		if (n=='#'-29 || n=='$'-29) n='#'-29-1;
+		if (n>=3) {
+			gdbPacketRawChar('*');
+			gdbPacketRawChar(n+29);
+			rleCount-=n+1;
+		} else {
+			rleCount--;
+		}
+	}
+}
+
 //Send a char as part of a packet
 static void ATTR_GDBFN gdbPacketChar(char c) {
 	if (c=='#' || c=='$' || c=='}' || c=='*') {
-		gdbSendChar('}');
-		gdbSendChar(c^0x20);
-		chsum+=(c^0x20)+'}';
+		gdbPacketFlushRun();
+		gdbPacketRawChar('}');
+		gdbPacketRawChar(c^0x20);
+	} else if (rleCount!=0 && c==rleChar) {
+		rleCount++;
 	} else {
-		gdbSendChar(c);
-		chsum+=c;
+		gdbPacketFlushRun();
+		rleChar=c;
+		rleCount=1;
 	}
 }
 
@@ -181,8 +376,12 @@ static void ATTR_GDBFN gdbPacketHex(int val, int bits) {
 
 //Finish sending a packet.
 static void ATTR_GDBFN gdbPacketEnd() {
+	char hexChars[]="0123456789abcdef";
+	gdbPacketFlushRun();
 	gdbSendChar('#');
-	gdbPacketHex(chsum, 8);
+	gdbSendChar(hexChars[(chsum>>4)&0xf]);
+	gdbSendChar(hexChars[chsum&0xf]);
+	STATS_ADD(pktsTx, 1);
 }
 
 //Error states used by the routines that grab stuff from the incoming gdb packet
@@ -190,6 +389,8 @@ static void ATTR_GDBFN gdbPacketEnd() {
 #define ST_ERR -2
 #define ST_OK -3
 #define ST_CONT -4
+#define ST_FILEIO -5
+#define ST_TIMEOUT -6
 
 //Grab a hex value from the gdb packet. Ptr will get positioned on the end
 //of the hex string, as far as the routine has read into it. Bits/4 indicates
@@ -241,29 +442,84 @@ static int ATTR_GDBFN iswap(int i) {
 	return r;
 }
 
+//Memory region flags
+#define MEM_RD 1	//readable
+#define MEM_WR 2	//writable
+#define MEM_CODE 4	//holds code, which doesn't change while tracing
+
+//The regions of the ESP8266 memory map gdb is allowed to touch. Anything outside of these reads as 0xff
+//and can't be written. All of these can be accessed as aligned 32-bit words; IRAM and flash even have
+//to be, byte accesses to them will throw an exception.
+struct memregion {
+	unsigned int start;
+	unsigned int end;
+	int flags;
+};
+
+static const struct memregion memRegions[]={
+	{0x3ff00000, 0x40000000, MEM_RD|MEM_WR},	//DPORT/WDEV registers and DRAM
+	{0x40000000, 0x40010000, MEM_RD|MEM_CODE},	//ROM
+	{0x40100000, 0x40140000, MEM_RD|MEM_WR|MEM_CODE},	//IRAM
+	{0x40200000, 0x40300000, MEM_RD|MEM_CODE},	//SPI flash, mapped through the cache
+	{0x60000000, 0x60002000, MEM_WR},			//Peripherals. Not readable: reading a FIFO register eats data.
+};
+
+//Returns the flags of the memory region that fully contains the len bytes starting at p, or 0 if there
+//is no such region.
+static int ATTR_GDBFN memRegionFlags(unsigned int p, unsigned int len) {
+	int i;
+	for (i=0; i<sizeof(memRegions)/sizeof(memRegions[0]); i++) {
+		if (p>=memRegions[i].start && p<memRegions[i].end && len<=memRegions[i].end-p) {
+			return memRegions[i].flags;
+		}
+	}
+	return 0;
+}
+
+//Read the aligned word that contains address p from the ESP8266 memory.
+static unsigned int ATTR_GDBFN readword(unsigned int p) {
+	if (!(memRegionFlags(p, 1)&MEM_RD)) return 0xffffffff;
+	return *((volatile unsigned int*)(p&(~3)));
+}
+
 //Read a byte from the ESP8266 memory.
 static unsigned char ATTR_GDBFN readbyte(unsigned int p) {
-	int *i=(int*)(p&(~3));
-	if (p<0x20000000 || p>=0x60000000) return -1;
-	return *i>>((p&3)*8);
+	return readword(p)>>((p&3)*8);
 }
 
-//Write a byte to the ESP8266 memory.
+//Write a byte to the ESP8266 memory. Caller should check if the address is writable.
 static void ATTR_GDBFN writeByte(unsigned int p, unsigned char d) {
 	int *i=(int*)(p&(~3));
-	if (p<0x20000000 || p>=0x60000000) return;
 	if ((p&3)==0) *i=(*i&0xffffff00)|(d<<0);
 	if ((p&3)==1) *i=(*i&0xffff00ff)|(d<<8);
 	if ((p&3)==2) *i=(*i&0xff00ffff)|(d<<16);
 	if ((p&3)==3) *i=(*i&0x00ffffff)|(d<<24);
 }
 
-//Returns 1 if it makes sense to write to addr p
-static int ATTR_GDBFN validWrAddr(int p) {
-	if (p>=0x3ff00000 && p<0x40000000) return 1;
-	if (p>=0x40100000 && p<0x40140000) return 1;
-	if (p>=0x60000000 && p<0x60002000) return 1;
-	return 0;
+//Write len bytes from d to the ESP8266 memory at p. Only the unaligned bytes at the start and end
+//need a read-modify-write; everything in between is written a word at a time. Returns 0 if (part of)
+//the range isn't writable, in which case nothing is written.
+static int ATTR_GDBFN memWrite(unsigned int p, unsigned char *d, int len) {
+	if (!(memRegionFlags(p, len)&MEM_WR)) return 0;
+	while (len>0 && (p&3)!=0) {
+		writeByte(p++, *d++);
+		len--;
+	}
+	while (len>=4) {
+		*((volatile unsigned int*)p)=d[0]|(d[1]<<8)|(d[2]<<16)|(d[3]<<24);
+		p+=4;
+		d+=4;
+		len-=4;
+	}
+	while (len>0) {
+		writeByte(p++, *d++);
+		len--;
+	}
+	//Make sure caches are up-to-date. Procedure according to Xtensa ISA document, ISYNC inst desc.
+#ifndef GDBSTUB_HOST
+	asm volatile("ISYNC\nISYNC\n");
+#endif
+	return 1;
 }
 
 /* 
@@ -282,15 +538,1754 @@ struct regfile {
 	uint32_t ps;
 };
 
+//Find the software breakpoint at addr. Returns its index, or -1 if there is none.
+static int ATTR_GDBFN swBreakpointFind(uint32_t addr) {
+	int i;
+	for (i=0; i<GDBSTUB_SW_BREAKPOINTS; i++) {
+		if (swBreakpoints[i].addr==addr && addr!=0) return i;
+	}
+	return -1;
+}
+
+//Put the BREAK (or BREAK.N) instruction of breakpoint i into memory. These are the same instructions
+//gdb itself uses for software breakpoints.
+static int ATTR_GDBFN swBreakpointArm(int i) {
+	unsigned char brk[3]={0x00, 0x40, 0x00};	//break 0,0
+	unsigned char brkn[2]={0x2d, 0xf0};			//break.n 0
+	return memWrite(swBreakpoints[i].addr, swBreakpoints[i].len==3?brk:brkn, swBreakpoints[i].len);
+}
+
+//Put the original instruction of breakpoint i back into memory.
+static void ATTR_GDBFN swBreakpointDisarm(int i) {
+	memWrite(swBreakpoints[i].addr, swBreakpoints[i].orig, swBreakpoints[i].len);
+}
+
+//Set a software breakpoint. Len is the length of the instruction at addr, flag what the breakpoint
+//is used for.
+static int ATTR_GDBFN swBreakpointSet(uint32_t addr, int len, int flag) {
+	int i, j;
+	i=swBreakpointFind(addr);
+	if (i!=-1) { //already set
+		swBreakpoints[i].flags|=flag;
+		return 1;
+	}
+	if (len!=2 && len!=3) return 0;
+	for (i=0; i<GDBSTUB_SW_BREAKPOINTS && swBreakpoints[i].addr!=0; i++) ;
+	if (i==GDBSTUB_SW_BREAKPOINTS) return 0;
+	for (j=0; j<len; j++) swBreakpoints[i].orig[j]=readbyte(addr+j);
+	swBreakpoints[i].addr=addr;
+	swBreakpoints[i].len=len;
+	swBreakpoints[i].flags=flag;
+	if (!swBreakpointArm(i)) {
+		//Not in writable memory. Flash, perhaps? Gdb needs to use a hardware breakpoint for that.
+		swBreakpoints[i].addr=0;
+		return 0;
+	}
+	return 1;
+}
+
+//Check if any of our software breakpoints overlaps the len bytes at addr.
+static int ATTR_GDBFN swBreakpointsIn(uint32_t addr, uint32_t len) {
+	int j;
+	for (j=0; j<GDBSTUB_SW_BREAKPOINTS; j++) {
+		if (swBreakpoints[j].addr!=0 && swBreakpoints[j].addr<addr+len &&
+				swBreakpoints[j].addr+swBreakpoints[j].len>addr) return 1;
+	}
+	return 0;
+}
+
+//B is the byte at addr in memory. If that's part of one of our breakpoints, return the byte of the
+//original instruction instead, so gdb sees the program as it is in the ELF file, like gdbserver does.
+static unsigned char ATTR_GDBFN swBreakpointOrigByte(uint32_t addr, unsigned char b) {
+	int j;
+	for (j=0; j<GDBSTUB_SW_BREAKPOINTS; j++) {
+		if (swBreakpoints[j].addr!=0 && addr-swBreakpoints[j].addr<swBreakpoints[j].len) {
+			b=swBreakpoints[j].orig[addr-swBreakpoints[j].addr];
+		}
+	}
+	return b;
+}
+
+//CRC-32 as gdb calculates it for qCRC: polynomial 0x04c11db7, MSB first, no final inversion. This table
+//does 4 bits at a time; a full byte table would take 1K of RAM.
+static const uint32_t crcTable[16]={
+	0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+	0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd
+};
+
+//Calculate the CRC of len bytes of memory at addr. Breakpoints we inserted are left out: the CRC is of
+//the original instructions, so it matches the ELF file. Returns 0 if the memory can't be read.
+static int ATTR_GDBFN memCrc(uint32_t addr, uint32_t len, uint32_t *crc) {
+	uint32_t w=0, i, c=0xffffffff;
+	unsigned char b;
+	int bps;
+	if (len==0 || !(memRegionFlags(addr, len)&MEM_RD)) return 0;
+	bps=swBreakpointsIn(addr, len);
+	for (i=0; i<len; i++) {
+		//Only load every word once, and take the bytes from that.
+		if (i==0 || ((addr+i)&3)==0) w=readword(addr+i);
+		b=w>>(((addr+i)&3)*8);
+		if (bps) b=swBreakpointOrigByte(addr+i, b);
+		c^=b<<24;
+		c=(c<<4)^crcTable[c>>28];
+		c=(c<<4)^crcTable[c>>28];
+	}
+	*crc=c;
+	return 1;
+}
+
+#define FLASH_MAP_START 0x40200000		//The first MB of flash shows up here in the address space
+#define FLASH_MAP_SECTORS 256			//Amount of 4K sectors in that MB
+
+#if GDBSTUB_FLASH_WRITE
+/*
+Flash programming for gdb 'load'. Gdb first erases the range it's going to write with vFlashErase, then
+writes it with vFlashWrite. Erasing is postponed: the writes are collected a sector at a time, and a sector
+is only erased and written if the new contents are different from what's in flash already. After an
+edit, that usually means only a few sectors get rewritten. The hardware watchdog keeps running even when
+ets_wdt_disable was called (and on FreeRTOS it isn't), so it's fed for every sector: erasing and writing
+lots of them in vFlashDone would otherwise reset the chip halfway.
+*/
+static uint32_t flashBuf[SPI_FLASH_SEC_SIZE/4];	//New contents of the sector being written
+static int flashBufSector=-1;			//Sector in flashBuf, -1 if none
+static unsigned char flashErase[FLASH_MAP_SECTORS/8];	//Sectors gdb erased that we haven't written yet
+
+//Write the sector in flashBuf to flash, if it isn't in there already. Returns 0 on a flash error.
+static int ATTR_GDBFN flashFlush() {
+	uint32_t cmp[16];
+	uint32_t addr=flashBufSector*SPI_FLASH_SEC_SIZE;
+	int i, j, same=1;
+	if (flashBufSector==-1) return 1;
+	keepWDTalive();
+	for (i=0; i<SPI_FLASH_SEC_SIZE/4 && same; i+=16) {
+		if (spi_flash_read(addr+i*4, cmp, sizeof(cmp))!=SPI_FLASH_RESULT_OK) return 0;
+		for (j=0; j<16; j++) {
+			if (cmp[j]!=flashBuf[i+j]) same=0;
+		}
+	}
+	if (!same) {
+		if (spi_flash_erase_sector(flashBufSector)!=SPI_FLASH_RESULT_OK) return 0;
+		if (spi_flash_write(addr, flashBuf, SPI_FLASH_SEC_SIZE)!=SPI_FLASH_RESULT_OK) return 0;
+	}
+	flashErase[flashBufSector/8]&=~(1<<(flashBufSector&7));
+	flashBufSector=-1;
+	return 1;
+}
+
+//Get a sector in flashBuf, writing out the one that's there. A sector gdb erased starts out empty.
+static int ATTR_GDBFN flashLoad(int sector) {
+	int i;
+	if (sector==flashBufSector) return 1;
+	if (!flashFlush()) return 0;
+	if (flashErase[sector/8]&(1<<(sector&7))) {
+		for (i=0; i<SPI_FLASH_SEC_SIZE/4; i++) flashBuf[i]=0xffffffff;
+	} else {
+		if (spi_flash_read(sector*SPI_FLASH_SEC_SIZE, flashBuf, SPI_FLASH_SEC_SIZE)!=SPI_FLASH_RESULT_OK) return 0;
+	}
+	flashBufSector=sector;
+	return 1;
+}
+
+//Handle vFlashErase: remember which sectors to erase. Has to be sector-aligned, as the memory map says.
+static int ATTR_GDBFN flashEraseCmd(uint32_t addr, uint32_t len) {
+	uint32_t sec;
+	if (addr<FLASH_MAP_START || addr-FLASH_MAP_START+len>FLASH_MAP_SECTORS*SPI_FLASH_SEC_SIZE) return 0;
+	if ((addr|len)&(SPI_FLASH_SEC_SIZE-1)) return 0;
+	if (!flashFlush()) return 0;
+	for (sec=(addr-FLASH_MAP_START)/SPI_FLASH_SEC_SIZE; len>0; sec++, len-=SPI_FLASH_SEC_SIZE) {
+		flashErase[sec/8]|=1<<(sec&7);
+	}
+	return 1;
+}
+
+//Handle vFlashWrite: put the data in the sector buffer.
+static int ATTR_GDBFN flashWriteCmd(uint32_t addr, unsigned char *data, int len) {
+	uint32_t off;
+	if (addr<FLASH_MAP_START || addr-FLASH_MAP_START+len>FLASH_MAP_SECTORS*SPI_FLASH_SEC_SIZE) return 0;
+	for (off=addr-FLASH_MAP_START; len>0; off++, len--) {
+		if (!flashLoad(off/SPI_FLASH_SEC_SIZE)) return 0;
+		((unsigned char*)flashBuf)[off%SPI_FLASH_SEC_SIZE]=*data++;
+	}
+	return 1;
+}
+
+//Handle vFlashDone: write out the last sector, and erase the ones that were erased but not written.
+static int ATTR_GDBFN flashDoneCmd() {
+	int i;
+	if (!flashFlush()) return 0;
+	for (i=0; i<FLASH_MAP_SECTORS; i++) {
+		keepWDTalive();
+		if ((flashErase[i/8]&(1<<(i&7))) && !(flashLoad(i) && flashFlush())) return 0;
+	}
+	return 1;
+}
+#endif
+
+//Remove a breakpoint condition from condBuf, moving the conditions after it down.
+static void ATTR_GDBFN condFree(struct bpcond *c) {
+	int i;
+	if (c->len==0) return;
+	for (i=c->off; i<condBufUsed-c->len; i++) condBuf[i]=condBuf[i+c->len];
+	condBufUsed-=c->len;
+	for (i=0; i<GDBSTUB_SW_BREAKPOINTS; i++) {
+		if (swBreakpoints[i].cond.off>c->off) swBreakpoints[i].cond.off-=c->len;
+	}
+	if (hwBpCond.off>c->off) hwBpCond.off-=c->len;
+	c->len=0;
+}
+
+//Replace the condition of a breakpoint by the one in a Z packet. Data points at what comes after the
+//breakpoint kind, end at the end of the packet. Returns 0 if the condition doesn't fit or can't be parsed;
+//the breakpoint is left without a condition then.
+static int ATTR_GDBFN condSet(struct bpcond *c, unsigned char *data, unsigned char *end) {
+	int i, n;
+	condFree(c);
+	if (data>=end || *data!=';') return 1; //no condition
+	data++;
+	c->off=condBufUsed;
+	//Conditions look like 'Xlen,bytecode' and come one after another. Stop at ';cmds:'; we don't
+	//advertise BreakpointCommands, so gdb shouldn't send those anyway.
+	while (data<end && *data=='X') {
+		data++;
+		n=gdbGetHexVal(&data, -1);
+		if (*data!=',' || n<=0 || n*2>end-data || condBufUsed+n+2>GDBSTUB_BP_COND_SIZE) {
+			condBufUsed=c->off;
+			return 0;
+		}
+		data++; //skip ','
+		condBuf[condBufUsed++]=n>>8;
+		condBuf[condBufUsed++]=n;
+		for (i=0; i<n; i++) condBuf[condBufUsed++]=gdbGetHexVal(&data, 8);
+	}
+	if (data<end && *data!=';') {
+		condBufUsed=c->off;
+		return 0;
+	}
+	c->len=condBufUsed-c->off;
+	return 1;
+}
+
+//Clear the software breakpoint at addr for the use indicated by flag. The BREAK is only taken out when
+//nothing uses the breakpoint anymore.
+static int ATTR_GDBFN swBreakpointClear(uint32_t addr, int flag) {
+	int i=swBreakpointFind(addr);
+	if (i==-1 || (swBreakpoints[i].flags&flag)==0) return 0;
+	swBreakpoints[i].flags&=~flag;
+	if (flag==BP_GDB) condFree(&swBreakpoints[i].cond);
+	if (swBreakpoints[i].flags==0) {
+		swBreakpointDisarm(i);
+		swBreakpoints[i].addr=0;
+	}
+	return 1;
+}
+
+//Set the hardware breakpoint. There's only one, but gdb and a tracepoint can share it.
+static int ATTR_GDBFN hwBreakpointSet(uint32_t addr, int flag) {
+	if (hwBpAddr==0 && gdbstub_set_hw_breakpoint(addr, 1)) hwBpAddr=addr;
+	if (hwBpAddr!=addr) return 0;
+	hwBpFlags|=flag;
+	return 1;
+}
+
+//Clear the hardware breakpoint for the use indicated by flag.
+static int ATTR_GDBFN hwBreakpointClear(uint32_t addr, int flag) {
+	if (hwBpAddr==0 || hwBpAddr!=addr || (hwBpFlags&flag)==0) return 0;
+	hwBpFlags&=~flag;
+	if (flag==BP_GDB) condFree(&hwBpCond);
+	if (hwBpFlags==0) {
+		gdbstub_del_hw_breakpoint(addr);
+		hwBpAddr=0;
+	}
+	return 1;
+}
+
+//Get the value of register n, numbered in the order the 'g' packet sends them. Returns 0 if there is
+//no such register.
+static int ATTR_GDBFN gdbGetReg(int n, uint32_t *v) {
+	if (n==0) *v=gdbstub_savedRegs.a0;
+	else if (n==1) *v=gdbstub_savedRegs.a1;
+	else if (n<16) *v=gdbstub_savedRegs.a[n-2];
+	else if (n==16) *v=gdbstub_savedRegs.pc;
+	else if (n==17) *v=gdbstub_savedRegs.sar;
+	else if (n==18) *v=gdbstub_savedRegs.litbase;
+	else if (n==19) *v=gdbstub_savedRegs.sr176;
+	else if (n==20) *v=0;
+	else if (n==21) *v=gdbstub_savedRegs.ps;
+	else return 0;
+	return 1;
+}
+
+//Read a little-endian value of len bytes from memory, for an agent expression. Only the lower 4 bytes
+//end up in *v. Returns 0 if the memory can't be read.
+static int ATTR_GDBFN axRead(uint32_t addr, int len, uint32_t *v) {
+	int i;
+	if (!(memRegionFlags(addr, len)&MEM_RD)) return 0;
+	*v=0;
+	for (i=0; i<len && i<4; i++) *v|=readbyte(addr+i)<<(i*8);
+	return 1;
+}
+
+#if GDBSTUB_TRACE_BUF_SIZE
+//A tracepoint, as defined by gdb with QTDP.
+struct tracepoint {
+	uint32_t addr;						//Address of the tracepoint
+	uint32_t hits;						//Times it was hit since tracing started
+	uint16_t num;						//Number gdb gave it
+	uint16_t pass;						//Stop tracing after this many hits, 0 for never
+	uint16_t condOff, condLen;			//Condition bytecode in traceActBuf, condLen=0 if there's none
+	uint16_t actOff, actLen;			//Memory and expression actions in traceActBuf
+	unsigned char enabled;
+	unsigned char regs;					//Collect the registers
+};
+
+#define TRACEPOINTLEN 8					//Amount of tracepoints
+#define TRACEACTLEN 512					//Space for the actions and conditions of all tracepoints
+#define TRACEMASK (GDBSTUB_TRACE_BUF_SIZE-1)
+#define TRACENREGS 22					//Registers in the 'g' packet, and in the 'R' block of a trace frame
+#if (GDBSTUB_TRACE_BUF_SIZE&TRACEMASK)!=0
+#error GDBSTUB_TRACE_BUF_SIZE should be a power of two
+#endif
+
+//How collecting trace data works right now
+#define TRACE_OFF 0						//Not collecting; trace bytecodes are an error
+#define TRACE_MEASURE 1					//Only count the bytes the trace frame needs
+#define TRACE_RECORD 2					//Store the data in the trace buffer
+
+static struct tracepoint tracepoints[TRACEPOINTLEN];
+static int tracepointCount;
+static unsigned char traceActBuf[TRACEACTLEN];
+static int traceActUsed;
+//Trace frames are stored back to back in traceBuf, wrapping around at the end. Each one is a 2-byte
+//tracepoint number and a 2-byte frame length, followed by blocks of data: 'R' with the registers,
+//or 'M' with a 4-byte address, a 2-byte length and that many bytes of memory. All of it is little-endian.
+static unsigned char traceBuf[GDBSTUB_TRACE_BUF_SIZE];
+static uint32_t traceTail;				//Where the oldest frame starts. Use with TRACEMASK.
+static uint32_t traceUsed;				//Bytes of traceBuf in use
+static uint32_t traceWr;				//Where the next byte of the frame being recorded goes
+static uint32_t traceEnd;				//End of the space reserved for that frame
+static uint32_t traceNeed;				//Bytes the frame being measured needs
+static int traceMode=TRACE_OFF;
+static int traceFrames;					//Amount of frames in the buffer
+static int traceCreated;				//Amount of frames created since tracing started
+static int traceRunning;
+static int traceCircular;				//Throw away old frames when the buffer is full, instead of stopping
+static char *traceWhy="tnotrun:0";		//Why tracing stopped, as qTStatus reports it
+static int traceWhyTp=-1;				//Tracepoint for tpasscount, -1 if that's not why
+static int traceCurFrame=-1;			//Frame gdb selected with QTFrame, -1 when looking at the live program
+
+//Store a byte of a trace frame. Never writes beyond the space measured for the frame.
+static void ATTR_GDBFN tracePut(unsigned char b) {
+	if (traceWr==traceEnd) return;
+	traceBuf[traceWr&TRACEMASK]=b;
+	traceWr++;
+}
+
+//Store a little-endian value of len bytes in a trace frame.
+static void ATTR_GDBFN tracePutLE(uint32_t v, int len) {
+	while (len--) {
+		tracePut(v);
+		v>>=8;
+	}
+}
+
+//Get a little-endian value of len bytes from the trace buffer at offset off.
+static uint32_t ATTR_GDBFN traceGetLE(uint32_t off, int len) {
+	uint32_t v=0;
+	while (len--) v|=traceBuf[(off+len)&TRACEMASK]<<(len*8);
+	return v;
+}
+
+//Collect len bytes of memory at addr into the trace frame, or count them when measuring. Memory that
+//can't be read is skipped; gdb shows it as unavailable.
+static void ATTR_GDBFN traceMem(uint32_t addr, uint32_t len) {
+	if (len==0 || len>0xffff || !(memRegionFlags(addr, len)&MEM_RD)) return;
+	if (traceMode==TRACE_MEASURE) {
+		traceNeed+=7+len;
+		return;
+	}
+	tracePut('M');
+	tracePutLE(addr, 4);
+	tracePutLE(len, 2);
+	while (len--) tracePut(readbyte(addr++));
+}
+#endif
+
+#define AXSTACKLEN 16					//Depth of the agent expression stack
+#define AXMAXSTEPS 1000					//Bytecodes an expression can execute, to get out of endless loops
+
+//Evaluate an agent expression of len bytes. Values are 32 bits wide, that being the size of anything on
+//this target; 64-bit constants and memory reads are truncated. Returns 0 if the expression can't be
+//evaluated (unsupported bytecode, unreadable memory, stack over/underflow, ...)
+static int ATTR_GDBFN axEval(unsigned char *ax, int len, uint32_t *result) {
+	int32_t st[AXSTACKLEN];
+	int sp=0;			//Number of values on the stack; top is st[sp-1]
+	int pc=0;
+	int steps;
+	int32_t a=0, b=0;
+	uint32_t v;
+	int op, i;
+	for (steps=0; steps<AXMAXSTEPS && pc<len; steps++) {
+		op=ax[pc++];
+		//Check the operands of the operators that take them from the stack are there.
+		if ((op>=0x02 && op<=0x0b) || (op>=0x0f && op<=0x11) || (op>=0x13 && op<=0x15)) {
+			if (sp<2) return 0;
+			b=st[--sp];
+			a=st[sp-1];
+		} else if ((op==0x0e || op==0x12 || (op>=0x16 && op<=0x1a) || op==0x20 || op==0x29 || op==0x2a) && sp<1) {
+			return 0;
+		}
+		switch (op) {
+			case 0x02: st[sp-1]=a+b; break;			//add
+			case 0x03: st[sp-1]=a-b; break;			//sub
+			case 0x04: st[sp-1]=a*b; break;			//mul
+			case 0x05: if (b==0) return 0; st[sp-1]=a/b; break;	//div_signed
+			case 0x06: if (b==0) return 0; st[sp-1]=(uint32_t)a/(uint32_t)b; break;	//div_unsigned
+			case 0x07: if (b==0) return 0; st[sp-1]=a%b; break;	//rem_signed
+			case 0x08: if (b==0) return 0; st[sp-1]=(uint32_t)a%(uint32_t)b; break;	//rem_unsigned
+			case 0x09: st[sp-1]=((uint32_t)b>=32)?0:(uint32_t)a<<b; break;	//lsh
+			case 0x0a: st[sp-1]=a>>(((uint32_t)b>=32)?31:b); break;	//rsh_signed
+			case 0x0b: st[sp-1]=((uint32_t)b>=32)?0:(uint32_t)a>>b; break;	//rsh_unsigned
+#if GDBSTUB_TRACE_BUF_SIZE
+			case 0x0c: case 0x2f:					//trace, tracenz
+				if (traceMode==TRACE_OFF || sp<2) return 0;
+				b=st[--sp];
+				a=st[--sp];
+				if (op==0x2f) {
+					//Collect up to and including the terminating zero.
+					for (i=0; i<b && readbyte(a+i)!=0; i++) ;
+					if (i<b) i++;
+					b=i;
+				}
+				traceMem(a, b);
+				break;
+			case 0x0d: case 0x30:					//trace_quick, trace16
+				i=(op==0x0d)?1:2;
+				if (traceMode==TRACE_OFF || sp<1 || pc+i>len) return 0;
+				traceMem(st[sp-1], (i==1)?ax[pc]:((ax[pc]<<8)|ax[pc+1]));
+				pc+=i;
+				break;
+#endif
+			case 0x0e: st[sp-1]=!st[sp-1]; break;		//log_not
+			case 0x0f: st[sp-1]=a&b; break;			//bit_and
+			case 0x10: st[sp-1]=a|b; break;			//bit_or
+			case 0x11: st[sp-1]=a^b; break;			//bit_xor
+			case 0x12: st[sp-1]=~st[sp-1]; break;		//bit_not
+			case 0x13: st[sp-1]=(a==b); break;		//equal
+			case 0x14: st[sp-1]=(a<b); break;			//less_signed
+			case 0x15: st[sp-1]=((uint32_t)a<(uint32_t)b); break;	//less_unsigned
+			case 0x16: case 0x2a:					//ext, zero_ext
+				if (pc>=len) return 0;
+				i=ax[pc++];
+				if (i>0 && i<32) {
+					v=st[sp-1]&((1<<i)-1);
+					if (op==0x16 && (v&(1<<(i-1)))) v|=~((1<<i)-1);
+					st[sp-1]=v;
+				}
+				break;
+			case 0x17: case 0x18: case 0x19: case 0x1a:	//ref8, ref16, ref32, ref64
+				if (!axRead(st[sp-1], 1<<(op-0x17), &v)) return 0;
+				st[sp-1]=v;
+				break;
+			case 0x20: case 0x21:					//if_goto, goto
+				if (pc+2>len) return 0;
+				i=(ax[pc]<<8)|ax[pc+1];
+				pc+=2;
+				if (op==0x21 || st[--sp]!=0) pc=i;
+				break;
+			case 0x22: case 0x23: case 0x24: case 0x25:	//const8, const16, const32, const64
+				i=1<<(op-0x22);
+				if (pc+i>len || sp==AXSTACKLEN) return 0;
+				v=0;
+				while (i--) v=(v<<8)|ax[pc++];
+				st[sp++]=v;
+				break;
+			case 0x26:								//reg
+				if (pc+2>len || sp==AXSTACKLEN) return 0;
+				if (!gdbGetReg((ax[pc]<<8)|ax[pc+1], &v)) return 0;
+				pc+=2;
+				st[sp++]=v;
+				break;
+			case 0x27:								//end
+				if (sp<1) return 0;
+				*result=st[sp-1];
+				return 1;
+			case 0x28:								//dup
+				if (sp<1 || sp==AXSTACKLEN) return 0;
+				st[sp]=st[sp-1];
+				sp++;
+				break;
+			case 0x29: sp--; break;					//pop
+			case 0x2b:								//swap
+				if (sp<2) return 0;
+				a=st[sp-1]; st[sp-1]=st[sp-2]; st[sp-2]=a;
+				break;
+			case 0x32:								//pick
+				if (pc>=len || ax[pc]>=sp || sp==AXSTACKLEN) return 0;
+				st[sp]=st[sp-1-ax[pc++]];
+				sp++;
+				break;
+			case 0x33:								//rot
+				if (sp<3) return 0;
+				a=st[sp-1]; st[sp-1]=st[sp-2]; st[sp-2]=st[sp-3]; st[sp-3]=a;
+				break;
+			default:
+				//Floating point, trace state variables and printf aren't supported.
+				return 0;
+		}
+	}
+	return 0;
+}
+
+//Evaluate a breakpoint condition. Gdb wants us to stop if any of its expressions is true, or if one of
+//them can't be evaluated.
+static int ATTR_GDBFN condTrue(struct bpcond *c) {
+	int p=c->off;
+	int n;
+	uint32_t v;
+	while (p<c->off+c->len) {
+		n=(condBuf[p]<<8)|condBuf[p+1];
+		if (!axEval(&condBuf[p+2], n, &v) || v!=0) return 1;
+		p+=n+2;
+	}
+	return 0;
+}
+
+//Find the breakpoint at addr. Returns what it is used for (0 if there's no breakpoint there) and sets
+//*c to its condition.
+static int ATTR_GDBFN gdbBreakpointAt(uint32_t addr, struct bpcond **c) {
+	int i=swBreakpointFind(addr);
+	if (i!=-1) {
+		*c=&swBreakpoints[i].cond;
+		return swBreakpoints[i].flags;
+	}
+	if (hwBpAddr!=0 && hwBpAddr==addr) {
+		*c=&hwBpCond;
+		return hwBpFlags;
+	}
+	*c=NULL;
+	return 0;
+}
+
+//The program ran into the breakpoint at addr. Decide if we should stop there: its condition has to be
+//true, and there must be no hits left to ignore.
+static int ATTR_GDBFN gdbBreakpointStop(uint32_t addr, struct bpcond *c) {
+	int i;
+	if (c->len!=0 && !condTrue(c)) return 0;
+	for (i=0; i<BPIGNORELEN; i++) {
+		if (bpIgnore[i].addr==addr && bpIgnore[i].count!=0) {
+			bpIgnore[i].count--;
+			if (bpIgnore[i].count==0) bpIgnore[i].addr=0;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#if GDBSTUB_TRACE_BUF_SIZE
+//Collect the registers into the trace frame, or count the bytes they need when measuring.
+static void ATTR_GDBFN traceRegs() {
+	int i;
+	uint32_t v;
+	if (traceMode==TRACE_MEASURE) {
+		traceNeed+=1+TRACENREGS*4;
+		return;
+	}
+	tracePut('R');
+	for (i=0; i<TRACENREGS; i++) {
+		gdbGetReg(i, &v);
+		tracePutLE(v, 4);
+	}
+}
+
+//Get a little-endian value of len bytes from the tracepoint actions.
+static uint32_t ATTR_GDBFN traceActGetLE(int off, int len) {
+	uint32_t v=0;
+	while (len--) v|=traceActBuf[off+len]<<(len*8);
+	return v;
+}
+
+//Do the actions of a tracepoint, in the current traceMode. Actions are stored in traceActBuf as 'M',
+//the base register (0xff if none), a 4-byte offset and a 2-byte length; or as 'X' followed by a 2-byte
+//length and the bytecode.
+static void ATTR_GDBFN traceActions(struct tracepoint *tp) {
+	int p=tp->actOff;
+	int n;
+	uint32_t addr, v;
+	if (tp->regs) traceRegs();
+	while (p<tp->actOff+tp->actLen) {
+		if (traceActBuf[p]=='M') {
+			addr=traceActGetLE(p+2, 4);
+			if (traceActBuf[p+1]!=0xff) {
+				gdbGetReg(traceActBuf[p+1], &v);
+				addr+=v;
+			}
+			traceMem(addr, traceActGetLE(p+6, 2));
+			p+=8;
+		} else {
+			n=traceActGetLE(p+1, 2);
+			axEval(&traceActBuf[p+3], n, &v);
+			p+=3+n;
+		}
+	}
+}
+
+//Stop tracing and take out the tracepoints. Why and tp are what qTStatus reports.
+static void ATTR_GDBFN traceStop(char *why, int tp) {
+	int i;
+	if (traceRunning) {
+		for (i=0; i<tracepointCount; i++) {
+			if (!swBreakpointClear(tracepoints[i].addr, BP_TRACE)) hwBreakpointClear(tracepoints[i].addr, BP_TRACE);
+		}
+	}
+	traceRunning=0;
+	traceWhy=why;
+	traceWhyTp=tp;
+}
+
+//Start tracing: empty the trace buffer and put in the tracepoints. Tracepoints in RAM get a BREAK;
+//one elsewhere can use the hardware breakpoint if gdb doesn't. Returns 0 if not all of them could
+//be put in.
+static int ATTR_GDBFN traceStart() {
+	int i;
+	uint32_t addr;
+	traceTail=0;
+	traceUsed=0;
+	traceFrames=0;
+	traceCreated=0;
+	traceCurFrame=-1;
+	traceRunning=1;
+	for (i=0; i<tracepointCount; i++) {
+		tracepoints[i].hits=0;
+		addr=tracepoints[i].addr;
+		if (!tracepoints[i].enabled) continue;
+		//Narrow (16-bit) instructions have bit 3 of the opcode set.
+		if (!swBreakpointSet(addr, (readbyte(addr)&8)?2:3, BP_TRACE) && !hwBreakpointSet(addr, BP_TRACE)) {
+			traceStop("tnotrun:0", -1);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Record a trace frame for tracepoint tp. The frame is measured first, so the oldest frames can be thrown
+//away to make room when the buffer is circular.
+static void ATTR_GDBFN traceFrame(struct tracepoint *tp) {
+	int n;
+	traceMode=TRACE_MEASURE;
+	traceNeed=4;
+	traceActions(tp);
+	traceMode=TRACE_OFF;
+	while (traceUsed+traceNeed>GDBSTUB_TRACE_BUF_SIZE || traceNeed>0xffff) {
+		if (!traceCircular || traceFrames==0) {
+			traceStop("tfull:0", -1);
+			return;
+		}
+		n=traceGetLE(traceTail+2, 2);
+		traceTail+=n;
+		traceUsed-=n;
+		traceFrames--;
+	}
+	traceWr=traceTail+traceUsed;
+	traceEnd=traceWr+traceNeed;
+	tracePutLE(tp->num, 2);
+	tracePutLE(traceNeed, 2);
+	traceMode=TRACE_RECORD;
+	traceActions(tp);
+	traceMode=TRACE_OFF;
+	//Pad the frame if it came out shorter than measured. A zero ends the list of blocks.
+	while (traceWr!=traceEnd) tracePut(0);
+	traceUsed+=traceNeed;
+	traceFrames++;
+	traceCreated++;
+}
+
+//The program ran into the tracepoint(s) at pc. Record a trace frame for each one whose condition is true.
+static void ATTR_GDBFN traceHit(uint32_t pc) {
+	struct tracepoint *tp;
+	uint32_t v;
+	int i;
+	for (i=0; i<tracepointCount && traceRunning; i++) {
+		tp=&tracepoints[i];
+		if (tp->addr!=pc || !tp->enabled) continue;
+		if (tp->condLen!=0 && (!axEval(&traceActBuf[tp->condOff], tp->condLen, &v) || v==0)) continue;
+		tp->hits++;
+		traceFrame(tp);
+		if (traceRunning && tp->pass!=0 && tp->hits>=tp->pass) traceStop("tpasscount:", tp->num);
+	}
+}
+
+//Copy n bytes of hex data from a packet into traceActBuf. Returns 0 if they don't fit.
+static int ATTR_GDBFN traceActHex(unsigned char **data, unsigned char *end, int n) {
+	if (n<=0 || n*2>end-*data || traceActUsed+n>TRACEACTLEN) return 0;
+	while (n--) traceActBuf[traceActUsed++]=gdbGetHexVal(data, 8);
+	return 1;
+}
+
+//Handle a QTDP packet, which defines a tracepoint or adds actions to it. Data points after 'QTDP:'.
+//Returns 0 if the tracepoint uses something we don't support, like while-stepping.
+static int ATTR_GDBFN traceDefine(unsigned char *data, unsigned char *end) {
+	struct tracepoint *tp;
+	int n, reg;
+	uint32_t addr, off;
+	if (traceRunning) return 0;
+	if (*data=='-') {
+		//QTDP:-n:addr:action... Gdb sends these right after the tracepoint itself, so the actions of
+		//every tracepoint end up together in traceActBuf.
+		data++;
+		n=gdbGetHexVal(&data, -1);
+		data++; //skip ':'
+		addr=gdbGetHexVal(&data, -1);
+		data++; //skip ':'
+		if (tracepointCount==0) return 0;
+		tp=&tracepoints[tracepointCount-1];
+		if (tp->num!=n || tp->addr!=addr) return 0;
+		while (data<end && *data!='-') {
+			if (*data=='R') {
+				//We always collect all registers; skip the mask.
+				tp->regs=1;
+				for (data++; (*data>='0' && *data<='9') || (*data>='a' && *data<='f') || (*data>='A' && *data<='F'); data++) ;
+			} else if (*data=='M') {
+				data++;
+				if (*data=='-') { //-1: no base register
+					data+=2;
+					reg=0xff;
+				} else {
+					reg=gdbGetHexVal(&data, -1);
+					if (reg>=TRACENREGS) return 0;
+				}
+				data++; //skip ','
+				off=gdbGetHexVal(&data, -1);
+				data++; //skip ','
+				n=gdbGetHexVal(&data, -1);
+				if (traceActUsed+8>TRACEACTLEN || n>0xffff) return 0;
+				traceActBuf[traceActUsed++]='M';
+				traceActBuf[traceActUsed++]=reg;
+				for (reg=0; reg<4; reg++) traceActBuf[traceActUsed++]=off>>(reg*8);
+				traceActBuf[traceActUsed++]=n;
+				traceActBuf[traceActUsed++]=n>>8;
+			} else if (*data=='X') {
+				data++;
+				n=gdbGetHexVal(&data, -1);
+				data++; //skip ','
+				if (traceActUsed+3>TRACEACTLEN) return 0;
+				traceActBuf[traceActUsed++]='X';
+				traceActBuf[traceActUsed++]=n;
+				traceActBuf[traceActUsed++]=n>>8;
+				if (!traceActHex(&data, end, n)) return 0;
+			} else {
+				return 0;
+			}
+		}
+		tp->actLen=traceActUsed-tp->actOff;
+	} else {
+		//QTDP:n:addr:E|D:step:pass[:Xlen,cond]
+		if (tracepointCount==TRACEPOINTLEN) return 0;
+		tp=&tracepoints[tracepointCount];
+		tp->num=gdbGetHexVal(&data, -1);
+		data++; //skip ':'
+		tp->addr=gdbGetHexVal(&data, -1);
+		data++; //skip ':'
+		tp->enabled=(*data=='E');
+		data+=2; //skip 'E:'
+		if (gdbGetHexVal(&data, -1)!=0) return 0; //while-stepping isn't supported
+		data++; //skip ':'
+		tp->pass=gdbGetHexVal(&data, -1);
+		tp->regs=0;
+		tp->condLen=0;
+		if (data<end && data[0]==':' && data[1]=='X') {
+			data+=2;
+			n=gdbGetHexVal(&data, -1);
+			data++; //skip ','
+			tp->condOff=traceActUsed;
+			if (!traceActHex(&data, end, n)) return 0;
+			tp->condLen=n;
+		}
+		if (data<end && *data!='-') return 0; //fast or static tracepoint
+		tp->actOff=traceActUsed;
+		tp->actLen=0;
+		tracepointCount++;
+	}
+	return 1;
+}
+
+//Get the offset in traceBuf of trace frame n.
+static uint32_t ATTR_GDBFN traceFrameOff(int n) {
+	uint32_t off=traceTail;
+	while (n--) off+=traceGetLE(off+2, 2);
+	return off;
+}
+
+//Get the address of the tracepoint that recorded the frame at off.
+static uint32_t ATTR_GDBFN traceFramePc(uint32_t off) {
+	int i;
+	for (i=0; i<tracepointCount; i++) {
+		if (tracepoints[i].num==traceGetLE(off, 2)) return tracepoints[i].addr;
+	}
+	return 0;
+}
+
+//Find a block of type t in the frame at off that holds addr (for 'M' blocks). Returns the offset of the
+//data in the block, or 0 if it isn't there.
+static uint32_t ATTR_GDBFN traceFindBlock(uint32_t off, unsigned char t, uint32_t addr) {
+	uint32_t end=off+traceGetLE(off+2, 2);
+	uint32_t a, n;
+	off+=4;
+	while (off<end) {
+		if (traceBuf[off&TRACEMASK]=='R') {
+			if (t=='R') return off+1;
+			off+=1+TRACENREGS*4;
+		} else if (traceBuf[off&TRACEMASK]=='M') {
+			a=traceGetLE(off+1, 4);
+			n=traceGetLE(off+5, 2);
+			if (t=='M' && addr>=a && addr-a<n) return off+7+(addr-a);
+			off+=7+n;
+		} else {
+			break;
+		}
+	}
+	return 0;
+}
+
+//Get a byte from memory as it was when the selected trace frame was recorded. Code doesn't change, so
+//it's read from the live program if it isn't in the frame. Returns 0 if the byte is unavailable.
+static int ATTR_GDBFN traceReadByte(uint32_t addr, unsigned char *b) {
+	uint32_t p=traceFindBlock(traceFrameOff(traceCurFrame), 'M', addr);
+	if (p!=0) {
+		*b=traceBuf[p&TRACEMASK];
+		return 1;
+	}
+	if (memRegionFlags(addr, 1)&MEM_CODE) {
+		*b=readbyte(addr);
+		return 1;
+	}
+	return 0;
+}
+
+//Handle 'g' and 'm' while gdb is looking at a trace frame.
+static int ATTR_GDBFN traceFrameRead(unsigned char *cmd) {
+	unsigned char *data=cmd+1;
+	uint32_t off=traceFrameOff(traceCurFrame);
+	uint32_t p, addr;
+	unsigned char b;
+	int i, n;
+	gdbPacketStart();
+	if (cmd[0]=='g') {
+		p=traceFindBlock(off, 'R', 0);
+		for (i=0; i<TRACENREGS; i++) {
+			if (p!=0) {
+				gdbPacketHex(iswap(traceGetLE(p+i*4, 4)), 32);
+			} else if (i==16) {
+				//Without registers, the tracepoint address is all we know of the PC.
+				gdbPacketHex(iswap(traceFramePc(off)), 32);
+			} else {
+				gdbPacketStr("xxxxxxxx");
+			}
+		}
+	} else {
+		addr=gdbGetHexVal(&data, -1);
+		data++; //skip ','
+		n=gdbGetHexVal(&data, -1);
+		//Send what's there, up to the first byte that isn't. Gdb will ask again for the rest.
+		if (!traceReadByte(addr, &b)) {
+			gdbPacketStr("E01");
+		} else {
+			for (i=0; i<n && traceReadByte(addr+i, &b); i++) gdbPacketHex(b, 8);
+		}
+	}
+	gdbPacketEnd();
+	return ST_OK;
+}
+
+//Handle QTFrame, which selects a trace frame to look at. Data points after 'QTFrame:'.
+static void ATTR_GDBFN traceSelectFrame(unsigned char *data) {
+	uint32_t a=0, b=0, pc;
+	int mode=0; //0: by number, 'p': by pc, 't': by tracepoint, 'r': pc in range, 'o': pc outside of range
+	int i;
+	if (strncmp((char*)data, "pc:", 3)==0 || strncmp((char*)data, "tdp:", 4)==0 ||
+			strncmp((char*)data, "range:", 6)==0 || strncmp((char*)data, "outside:", 8)==0) {
+		mode=(data[0]=='r')?'r':data[0];
+		while (*data!=':') data++;
+		data++;
+		a=gdbGetHexVal(&data, -1);
+		if (*data==':') {
+			data++;
+			b=gdbGetHexVal(&data, -1);
+		}
+		//These search forward from the frame after the current one.
+		for (i=traceCurFrame+1; i<traceFrames; i++) {
+			pc=traceFramePc(traceFrameOff(i));
+			if (mode=='p' && pc==a) break;
+			if (mode=='t' && traceGetLE(traceFrameOff(i), 2)==a) break;
+			if (mode=='r' && pc>=a && pc<=b) break;
+			if (mode=='o' && (pc<a || pc>b)) break;
+		}
+	} else {
+		i=gdbGetHexVal(&data, -1); //ffffffff (-1) means: back to the live program
+	}
+	if (i<0 || i>=traceFrames) {
+		traceCurFrame=-1;
+		gdbPacketStr("F-1");
+		return;
+	}
+	traceCurFrame=i;
+	gdbPacketChar('F');
+	gdbPacketHex(i, 32);
+	gdbPacketChar('T');
+	gdbPacketHex(traceGetLE(traceFrameOff(i), 2), 16);
+}
+
+//The tracepoint packets gdbHandleTrace knows, up to where their arguments start. Other packets start
+//with qT too, e.g. qThreadExtraInfo.
+static const char * const tracePackets[]={"QTinit", "QTDP:", "QTStart", "QTStop", "QTBuffer:", "QTro", "QTDV:",
+		"QTFrame:", "qTStatus", "qTP:", "qTfP", "qTsP", "qTfV", "qTsV"};
+
+static int ATTR_GDBFN isTracePacket(unsigned char *cmd) {
+	int i;
+	for (i=0; i<sizeof(tracePackets)/sizeof(tracePackets[0]); i++) {
+		if (strncmp((char*)cmd, tracePackets[i], strlen(tracePackets[i]))==0) return 1;
+	}
+	return 0;
+}
+
+//Handle the tracepoint packets listed in tracePackets.
+static int ATTR_GDBFN gdbHandleTrace(unsigned char *cmd, int len) {
+	unsigned char *data;
+	int i, n;
+	gdbPacketStart();
+	if (strcmp((char*)cmd, "QTinit")==0) {
+		traceStop("tnotrun:0", -1);
+		tracepointCount=0;
+		traceActUsed=0;
+		traceFrames=0;
+		traceUsed=0;
+		traceCurFrame=-1;
+		gdbPacketStr("OK");
+	} else if (strncmp((char*)cmd, "QTDP:", 5)==0) {
+		if (traceDefine(cmd+5, cmd+len)) {
+			gdbPacketStr("OK");
+		} else {
+			gdbPacketStr("E01");
+		}
+	} else if (strcmp((char*)cmd, "QTStart")==0) {
+		if (traceStart()) {
+			gdbPacketStr("OK");
+		} else {
+			gdbPacketStr("E01");
+		}
+	} else if (strcmp((char*)cmd, "QTStop")==0) {
+		if (traceRunning) traceStop("tstop:0", -1);
+		gdbPacketStr("OK");
+	} else if (strncmp((char*)cmd, "QTBuffer:circular:", 18)==0) {
+		data=cmd+18;
+		traceCircular=gdbGetHexVal(&data, -1);
+		gdbPacketStr("OK");
+	} else if (strncmp((char*)cmd, "QTro", 4)==0 || strncmp((char*)cmd, "QTDV:", 5)==0) {
+		//Code is always read from the live program, and trace state variables aren't supported; ignore these.
+		gdbPacketStr("OK");
+	} else if (strncmp((char*)cmd, "QTFrame:", 8)==0) {
+		traceSelectFrame(cmd+8);
+	} else if (strcmp((char*)cmd, "qTStatus")==0) {
+		gdbPacketStr(traceRunning?"T1":"T0;");
+		if (!traceRunning) {
+			gdbPacketStr(traceWhy);
+			if (traceWhyTp!=-1) gdbPacketHex(traceWhyTp, 16);
+		}
+		gdbPacketStr(";tframes:");
+		gdbPacketHex(traceFrames, 32);
+		gdbPacketStr(";tcreated:");
+		gdbPacketHex(traceCreated, 32);
+		gdbPacketStr(";tfree:");
+		gdbPacketHex(GDBSTUB_TRACE_BUF_SIZE-traceUsed, 32);
+		gdbPacketStr(";tsize:");
+		gdbPacketHex(GDBSTUB_TRACE_BUF_SIZE, 32);
+		gdbPacketStr(";circular:");
+		gdbPacketHex(traceCircular, 4);
+		gdbPacketStr(";disconn:0");
+	} else if (strncmp((char*)cmd, "qTP:", 4)==0) {	//Tracepoint status: hits and bytes used
+		data=cmd+4;
+		n=gdbGetHexVal(&data, -1);
+		for (i=0; i<tracepointCount && tracepoints[i].num!=n; i++) ;
+		if (i<tracepointCount) {
+			gdbPacketChar('V');
+			gdbPacketHex(tracepoints[i].hits, 32);
+			gdbPacketStr(":0");
+		}
+	} else if (strcmp((char*)cmd, "qTfP")==0 || strcmp((char*)cmd, "qTsP")==0 ||
+				strcmp((char*)cmd, "qTfV")==0 || strcmp((char*)cmd, "qTsV")==0) {
+		//We don't upload tracepoint definitions to gdb.
+		gdbPacketChar('l');
+	} else {
+		gdbPacketEnd();
+		return ST_ERR;
+	}
+	gdbPacketEnd();
+	return ST_OK;
+}
+#endif
+
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+//Send buffered console output to gdb as 'O' packets. If block is 0, this only sends what fits in
+//the UART TX FIFO right now, so it never waits; otherwise it sends everything.
+static void ATTR_GDBFN gdbConsoleDrain(int block) {
+	int n, i, room;
+	//We can only tell if sending would wait for the UART; other transports get the output when we stop.
+	if (!block && transport!=&gdbUart0Transport) return;
+	while (obufHead!=obufTail) {
+		//A packet of n chars takes 2n+5 bytes in the FIFO: $O, the hex data and #xx
+		room=126-((READ_PERI_REG(UART_STATUS(0))>>UART_TXFIFO_CNT_S)&UART_TXFIFO_CNT);
+		n=(room-5)/2;
+		if (block) n=60;
+		if (n<=0) return;
+		if (n>obufHead-obufTail) n=obufHead-obufTail;
+		gdbPacketStart();
+		gdbPacketChar('O');
+		for (i=0; i<n; i++) gdbPacketHex(obuf[(obufTail+i)&(GDBSTUB_CONSOLE_BUF_SIZE-1)], 8);
+		gdbPacketEnd();
+		obufTail+=n;
+	}
+}
+
+#if GDBSTUB_CTRLC_BREAK
+//Called from the UART interrupt handler. The TX FIFO ran (nearly) empty, so there's room to send
+//more console output.
+static void ATTR_GDBFN gdbConsoleTxInt() {
+	gdbConsoleDrain(0);
+	//With another transport, the drain doesn't send anything; don't keep getting this interrupt for nothing.
+	if (obufHead==obufTail || transport!=&gdbUart0Transport) {
+		CLEAR_PERI_REG_MASK(UART_INT_ENA(0), UART_TXFIFO_EMPTY_INT_ENA);
+	}
+	WRITE_PERI_REG(UART_INT_CLR(0), UART_TXFIFO_EMPTY_INT_CLR);
+}
+#endif
+
+//Replacement putchar1 routine. Instead of spitting out the character directly, it puts it in the obuf
+//ring buffer. Once there is a \n or OBUFLEN characters, the buffer is sent out as gdb stdout packets
+//by the UART TX interrupt, so printing never has to wait for the serial port. Without the UART
+//interrupt (no GDBSTUB_CTRLC_BREAK), whatever fits in the TX FIFO is sent out directly. In both cases,
+//everything left is sent when the debugger is entered. This only works for one writer at a time.
+static void ATTR_GDBFN gdb_semihost_putchar1(char c) {
+	if (obufHead-obufTail>=GDBSTUB_CONSOLE_BUF_SIZE) {
+		gdbstub_console_dropped++;
+		return;
+	}
+	obuf[obufHead&(GDBSTUB_CONSOLE_BUF_SIZE-1)]=c;
+	obufHead++;
+	if (c=='\n' || obufHead-obufTail>=OBUFLEN) {
+#if GDBSTUB_CTRLC_BREAK
+		if (transport==&gdbUart0Transport) SET_PERI_REG_MASK(UART_INT_ENA(0), UART_TXFIFO_EMPTY_INT_ENA);
+#else
+		//Don't put console packets in the middle of a File-I/O request; it drains the buffer when it starts.
+		if (!fileIoBusy) gdbConsoleDrain(0);
+#endif
+	}
+}
+#endif
+
+#if GDBSTUB_UART_RX_BUF_SIZE
+//Put a received char in ibuf without passing it on to the program yet. Called from the UART interrupt
+//handler for the chars of a packet: if it turns out not to be a valid packet, they're for the program.
+static void ATTR_GDBFN gdbUartRxHold(unsigned char c) {
+	if (ibufPend-ibufTail>=GDBSTUB_UART_RX_BUF_SIZE) {
+		gdbstub_uart_rx_dropped++;
+		return;
+	}
+	ibuf[ibufPend&(GDBSTUB_UART_RX_BUF_SIZE-1)]=c;
+	ibufPend++;
+}
+
+//Called from the UART interrupt handler for a received char that isn't for us. Gdb's acks for our
+//console packets aren't passed on either.
+static void ATTR_GDBFN gdbUartRxPut(unsigned char c) {
+	if (gdbAttached && (c=='+' || c=='-')) return;
+	gdbUartRxHold(c);
+	ibufHead=ibufPend;
+}
+#endif
+
+//Read up to len received chars into buf. Returns the amount read, which is 0 if there's nothing.
+int ATTR_GDBFN gdbstub_uart_read(void *buf, int len) {
+	int n=0;
+#if GDBSTUB_UART_RX_BUF_SIZE
+	unsigned int tail=ibufTail;
+	while (n<len && tail!=ibufHead) {
+		((unsigned char*)buf)[n++]=ibuf[tail&(GDBSTUB_UART_RX_BUF_SIZE-1)];
+		tail++;
+	}
+	ibufTail=tail;
+#endif
+	return n;
+}
+
+//Set the function that's called when new chars can be read with gdbstub_uart_read.
+void ATTR_GDBFN gdbstub_uart_set_rx_callback(void (*cb)(void)) {
+#if GDBSTUB_UART_RX_BUF_SIZE
+	ibufCallback=cb;
+#endif
+}
+
+//Talk to gdb using t instead of UART0, or go back to UART0 if t is NULL.
+void ATTR_GDBFN gdbstub_set_transport(const struct gdbstub_transport *t) {
+	transport=(t!=NULL)?t:&gdbUart0Transport;
+}
+
+//Gdb sent a control-C over the transport while the program runs. Stop with the BREAK in
+//gdbstub_do_break; gdbstub_handle_debug_exception tells gdb it was a control-C.
+void ATTR_GDBFN gdbstub_transport_ctrlc() {
+	transportCtrlC=1;
+	gdbstub_do_break();
+}
+
+//Send a string to the gdb console, for output of monitor commands.
+static void ATTR_GDBFN gdbMonitorPuts(char *s) {
+	gdbPacketStart();
+	gdbPacketChar('O');
+	while (*s!=0) gdbPacketHex(*s++, 8);
+	gdbPacketEnd();
+}
+
+//Switch UART0 to a different baud rate. The OK for the command still goes out at the old rate; if no
+//valid packet comes in at the new rate within GDBSTUB_BAUD_FALLBACK_MS, gdbRecvChar switches back.
+static void ATTR_GDBFN gdbSetBaud(int baud) {
+	uint32_t olddiv=READ_PERI_REG(UART_CLKDIV(0))&UART_CLKDIV_CNT;
+	uint32_t t;
+	gdbPacketStart();
+	gdbPacketStr("OK");
+	gdbPacketEnd();
+	//Wait until the FIFO is empty, then for the last char to leave the shift register.
+	gdbUart0Flush();
+	t=WDEV_NOW();
+	while (WDEV_NOW()-t<(olddiv*12)/(UART_CLK_FREQ/1000000)+1) ;
+	WRITE_PERI_REG(UART_CLKDIV(0), UART_CLK_FREQ/baud);
+	baudFallbackDiv=olddiv;
+	baudFallbackTime=WDEV_NOW()+GDBSTUB_BAUD_FALLBACK_MS*1000;
+}
+
+//Parse a number in a monitor command: decimal, or hex if it starts with 0x. Moves *p past it.
+static uint32_t ATTR_GDBFN gdbMonitorNum(char **p) {
+	uint32_t v=0;
+	char *c=*p;
+	if (c[0]=='0' && c[1]=='x') {
+		c+=2;
+		v=gdbGetHexVal((unsigned char**)&c, -1);
+	} else {
+		for (; *c>='0' && *c<='9'; c++) v=v*10+(*c-'0');
+	}
+	*p=c;
+	return v;
+}
+
+//Finish a monitor command with an OK or an error reply.
+static int ATTR_GDBFN gdbMonitorReply(int ok) {
+	gdbPacketStart();
+	gdbPacketStr(ok?"OK":"E01");
+	gdbPacketEnd();
+	return ok?ST_OK:ST_ERR;
+}
+
+#if GDBSTUB_PROFILE_SIZE || GDBSTUB_STATS
+//Write v to buf in decimal. Returns a pointer to the end of the number.
+static char * ATTR_GDBFN gdbFmtDec(char *buf, uint32_t v) {
+	uint32_t t;
+	char *end=buf+1;
+	for (t=v; t>=10; t/=10) end++;
+	*end=0;
+	buf=end;
+	do {
+		*--buf='0'+v%10;
+		v/=10;
+	} while (v!=0);
+	return end;
+}
+#endif
+
+#if GDBSTUB_PROFILE_SIZE
+/*
+Statistical profiler. A timer interrupt takes the PC and a0 of the code it interrupted, and counts how
+often each combination occurs. With the call0 ABI, a0 usually is the return address, so that tells who
+called the function. The counts are kept in a hash table; if it fills up, further new combinations are
+only counted as dropped.
+*/
+struct profentry {
+	uint32_t pc;
+	uint32_t caller;					//a0 at the time of the sample
+	uint32_t count;						//0 if the entry is unused
+};
+
+#define PROF_PROBES 8					//Entries to try before giving up on a sample
+
+static struct profentry profHist[GDBSTUB_PROFILE_SIZE];
+static uint32_t profSamples;			//Total samples taken
+static uint32_t profDropped;			//Samples that didn't fit in profHist
+static int profHz;						//Sample rate, 0 when the profiler isn't running
+
+//Count a sample.
+static void ATTR_GDBFN profSample(uint32_t pc, uint32_t a0) {
+	uint32_t h=((pc>>1)^((a0>>1)*0x9e3779b1))&(GDBSTUB_PROFILE_SIZE-1);
+	int i;
+	profSamples++;
+	for (i=0; i<PROF_PROBES; i++) {
+		if (profHist[h].count==0) {
+			profHist[h].pc=pc;
+			profHist[h].caller=a0;
+		}
+		if (profHist[h].pc==pc && profHist[h].caller==a0) {
+			profHist[h].count++;
+			return;
+		}
+		h=(h+1)&(GDBSTUB_PROFILE_SIZE-1);
+	}
+	profDropped++;
+}
+
+#if !GDBSTUB_FREERTOS
+//Timer interrupt. Frame is the one the Xtensa HAL saved, like in uart_hdlr.
+static void ATTR_GDBFN prof_hdlr(void *arg, void *frame) {
+	struct XTensa_exception_frame_s *f=(struct XTensa_exception_frame_s*)frame;
+	WRITE_PERI_REG(REG_FRC1_INT, 1);
+	profSample(f->pc, f->a0);
+}
+#else
+//Timer interrupt. This routine is called by gdbstub_prof_entry in gdbstub-entry.S.
+void ATTR_GDBFN gdbstub_handle_prof_int(struct XTensa_rtos_int_frame_s *frame) {
+	WRITE_PERI_REG(REG_FRC1_INT, 1);
+	profSample(frame->pc, frame->a[0]);
+}
+#endif
+
+//Start sampling at hz samples per second, using the FRC1 timer.
+static void ATTR_GDBFN profStart(int hz) {
+#if GDBSTUB_FREERTOS
+	_xt_isr_attach(ETS_FRC_TIMER1_INUM, gdbstub_prof_entry);
+#else
+	ets_isr_attach(ETS_FRC_TIMER1_INUM, prof_hdlr, NULL);
+#endif
+	WRITE_PERI_REG(REG_FRC1_LOAD, FRC1_CLK/hz);
+	WRITE_PERI_REG(REG_FRC1_CTRL, FRC1_CTRL_ENABLE|FRC1_CTRL_AUTOLOAD|FRC1_CTRL_DIV16);
+	SET_PERI_REG_MASK(REG_EDGE_INT_ENABLE, BIT(1));
+#if GDBSTUB_FREERTOS
+	_xt_isr_unmask(1<<ETS_FRC_TIMER1_INUM);
+#else
+	ets_isr_unmask(1<<ETS_FRC_TIMER1_INUM);
+#endif
+	profHz=hz;
+}
+
+//Stop sampling.
+static void ATTR_GDBFN profStop() {
+#if GDBSTUB_FREERTOS
+	_xt_isr_mask(1<<ETS_FRC_TIMER1_INUM);
+#else
+	ets_isr_mask(1<<ETS_FRC_TIMER1_INUM);
+#endif
+	WRITE_PERI_REG(REG_FRC1_CTRL, 0);
+	profHz=0;
+}
+
+
+//Format a histogram entry as a line of text: pc and caller in hex, then the count. Buf needs 30 bytes.
+static void ATTR_GDBFN profFormat(char *buf, struct profentry *e) {
+	char hexChars[]="0123456789abcdef";
+	int i;
+	for (i=0; i<8; i++) buf[i]=hexChars[(e->pc>>(28-i*4))&0xf];
+	buf[8]=' ';
+	for (i=0; i<8; i++) buf[9+i]=hexChars[(e->caller>>(28-i*4))&0xf];
+	buf[17]=' ';
+	buf=gdbFmtDec(&buf[18], e->count);
+	buf[0]='\n';
+	buf[1]=0;
+}
+
+//Write a line with the total amount of samples. Buf needs 41 bytes.
+static void ATTR_GDBFN profTotals(char *buf) {
+	const char *s;
+	for (s="# samples "; *s!=0; s++) *buf++=*s;
+	buf=gdbFmtDec(buf, profSamples);
+	for (s=" dropped "; *s!=0; s++) *buf++=*s;
+	buf=gdbFmtDec(buf, profDropped);
+	buf[0]='\n';
+	buf[1]=0;
+}
+
+//Handle 'monitor prof'. Args is what comes after it.
+static int ATTR_GDBFN gdbMonitorProf(char *args) {
+	char buf[48];
+	int i;
+	if (strncmp(args, "start", 5)==0) {
+		args+=5;
+		while (*args==' ') args++;
+		i=(*args==0)?1000:gdbMonitorNum(&args);
+		if (*args!=0 || i<1 || i>FRC1_CLK/100) {
+			gdbMonitorPuts("Usage: monitor prof start [HZ]\n");
+			return gdbMonitorReply(0);
+		}
+		profStart(i);
+	} else if (strcmp(args, "stop")==0) {
+		profStop();
+	} else if (strcmp(args, "reset")==0) {
+		for (i=0; i<GDBSTUB_PROFILE_SIZE; i++) profHist[i].count=0;
+		profSamples=0;
+		profDropped=0;
+	} else if (strcmp(args, "dump")==0) {
+		for (i=0; i<GDBSTUB_PROFILE_SIZE; i++) {
+			if (profHist[i].count==0) continue;
+			profFormat(buf, &profHist[i]);
+			gdbMonitorPuts(buf);
+		}
+	}
+	//Always finish with the status.
+	gdbMonitorPuts(profHz?"# profiler running\n":"# profiler stopped\n");
+	profTotals(buf);
+	gdbMonitorPuts(buf);
+	return gdbMonitorReply(1);
+}
+#endif
+
+#if GDBSTUB_STATS
+//Show one counter of 'monitor stats'.
+static void ATTR_GDBFN statsPut(const char *name, uint32_t v) {
+	char buf[48];
+	char *p=buf;
+	while (*name!=0) *p++=*name++;
+	p=gdbFmtDec(p, v);
+	p[0]='\n';
+	p[1]=0;
+	gdbMonitorPuts(buf);
+}
+
+//Handle 'monitor stats'. Args is what comes after it.
+static int ATTR_GDBFN gdbMonitorStats(char *args) {
+	const char * const buckets[STATS_BUCKETS]={"  <1ms:    ", "  <10ms:   ", "  <100ms:  ",
+			"  <1s:     ", "  <10s:    ", "  longer:  "};
+	int i;
+	if (strcmp(args, "reset")==0) {
+		for (i=0; i<sizeof(gdbStats)/4; i++) ((uint32_t*)&gdbStats)[i]=0;
+	} else if (*args!=0) {
+		gdbMonitorPuts("Usage: monitor stats [reset]\n");
+		return gdbMonitorReply(0);
+	}
+	statsPut("Bytes received:      ", gdbStats.bytesRx);
+	statsPut("Bytes sent:          ", gdbStats.bytesTx);
+	statsPut("Packets received:    ", gdbStats.pktsRx);
+	statsPut("Packets sent:        ", gdbStats.pktsTx);
+	statsPut("Checksum errors:     ", gdbStats.badChsum);
+	statsPut("Nacks from gdb:      ", gdbStats.naksRx);
+	statsPut("Command time (us):   ", gdbStats.cmdTime);
+	statsPut("Slowest command (us):", gdbStats.cmdMax);
+	statsPut("Stops:               ", gdbStats.stops);
+	statsPut("Halted (ms):         ", gdbStats.haltTime);
+	statsPut("Longest stop (ms):   ", gdbStats.haltMax);
+	gdbMonitorPuts("Stops by length:\n");
+	for (i=0; i<STATS_BUCKETS; i++) statsPut(buckets[i], gdbStats.haltHist[i]);
+	return gdbMonitorReply(1);
+}
+#endif
+
+//Handle 'monitor baud'. Args is what comes after it.
+static int ATTR_GDBFN gdbMonitorBaud(char *args) {
+	int i=gdbMonitorNum(&args);
+	if (transport!=&gdbUart0Transport) {
+		gdbMonitorPuts("Not talking to gdb over UART0\n");
+		return gdbMonitorReply(0);
+	}
+	if (*args!=0 || i<300 || UART_CLK_FREQ/i<16 || UART_CLK_FREQ/i>UART_CLKDIV_CNT) {
+		gdbMonitorPuts("Invalid baud rate\n");
+		return gdbMonitorReply(0);
+	}
+	//This sends the OK itself, before switching.
+	gdbSetBaud(i);
+	return ST_OK;
+}
+
+//Handle 'monitor ignore'. Args is what comes after it.
+static int ATTR_GDBFN gdbMonitorIgnore(char *args) {
+	uint32_t addr=gdbMonitorNum(&args);
+	int i, j;
+	while (*args==' ') args++;
+	i=gdbMonitorNum(&args);
+	//Re-use the entry for this address if there is one, otherwise take a free one.
+	for (j=0; j<BPIGNORELEN && bpIgnore[j].addr!=addr; j++) ;
+	if (j==BPIGNORELEN) for (j=0; j<BPIGNORELEN && bpIgnore[j].addr!=0; j++) ;
+	if (*args!=0 || addr==0 || j==BPIGNORELEN) {
+		gdbMonitorPuts("Usage: monitor ignore ADDR N. At most 4 breakpoints can have an ignore count.\n");
+		return gdbMonitorReply(0);
+	}
+	bpIgnore[j].addr=(i==0)?0:addr;
+	bpIgnore[j].count=i;
+	return gdbMonitorReply(1);
+}
+
+//A monitor command. The handler gets the arguments, and has to send the reply to gdb.
+struct monitorcmd {
+	const char *name;
+	int (*handler)(char *args);
+	const char *help;
+};
+
+static const struct monitorcmd monitorCmds[]={
+	{"baud", gdbMonitorBaud, "  baud N - switch the serial port to N baud; reconnect gdb at that rate\n"},
+	{"ignore", gdbMonitorIgnore, "  ignore ADDR N - don't stop at the breakpoint at ADDR the next N times\n"},
+#if GDBSTUB_PROFILE_SIZE
+	{"prof", gdbMonitorProf, "  prof start [HZ] - sample the PC HZ (default 1000) times per second while running\n"
+			"  prof stop - stop sampling\n"
+			"  prof reset - clear the samples\n"
+			"  prof dump - show the samples: pc, caller and count\n"},
+#endif
+#if GDBSTUB_STATS
+	{"stats", gdbMonitorStats, "  stats [reset] - show (or clear) the counters of the stub\n"},
+#endif
+};
+
+//Handle a monitor command. Cmd is the command gdb sent, already converted from hex.
+static int ATTR_GDBFN gdbHandleMonitor(char *cmd) {
+	int i, n;
+	for (i=0; i<sizeof(monitorCmds)/sizeof(monitorCmds[0]); i++) {
+		n=strlen(monitorCmds[i].name);
+		if (strncmp(cmd, monitorCmds[i].name, n)==0 && (cmd[n]==0 || cmd[n]==' ')) {
+			cmd+=n;
+			while (*cmd==' ') cmd++;
+			return monitorCmds[i].handler(cmd);
+		}
+	}
+	//'monitor help' (or just 'monitor') shows the list. Anything else is a typo; make sure scripts notice.
+	n=(*cmd==0 || strcmp(cmd, "help")==0);
+	if (!n) gdbMonitorPuts("Unknown monitor command\n");
+	gdbMonitorPuts("Supported monitor commands:\n");
+	for (i=0; i<sizeof(monitorCmds)/sizeof(monitorCmds[0]); i++) gdbMonitorPuts((char*)monitorCmds[i].help);
+	return gdbMonitorReply(n);
+}
+
+/*
+qXfer objects. These are generated on the fly, in two passes: the first one only counts the characters, so
+we know if the chunk gdb asks for is the last one, the second one sends the part of the chunk gdb asked for.
+That way, no buffer for the whole document is needed.
+*/
+static int xferOff, xferLen;			//Chunk of the object gdb wants
+static int xferPos;						//Position in the object we're generating
+static int xferSend;					//0 when only counting, 1 when sending
+
+//Add a string to the object we're generating.
+static void ATTR_GDBFN xferStr(const char *c) {
+	while (*c!=0) {
+		if (xferSend && xferPos>=xferOff && xferPos-xferOff<xferLen) gdbPacketChar(*c);
+		xferPos++;
+		c++;
+	}
+}
+
+//Add a number to the object we're generating, in hex (with 0x) or decimal.
+static void ATTR_GDBFN xferNum(unsigned int val, int hex) {
+	char buf[11];
+	char hexChars[]="0123456789abcdef";
+	int i=sizeof(buf)-1;
+	buf[i]=0;
+	do {
+		buf[--i]=hexChars[val%(hex?16:10)];
+		val/=(hex?16:10);
+	} while (val!=0);
+	if (hex) xferStr("0x");
+	xferStr(&buf[i]);
+}
+
+//Generate the memory map, from the same region table readbyte and friends use. Knowing what's ROM
+//makes gdb use the hardware breakpoint for code in flash by itself.
+static void ATTR_GDBFN xferMemoryMap() {
+	int i;
+	xferStr("<?xml version=\"1.0\"?>\n<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+			"\"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n<memory-map>\n");
+	for (i=0; i<sizeof(memRegions)/sizeof(memRegions[0]); i++) {
+		//The map has no type for write-only memory, and as 'ram' gdb would read it. Leave the peripherals
+		//out; 'set mem inaccessible-by-default off' still lets you write them from gdb.
+		if (!(memRegions[i].flags&MEM_RD)) continue;
+		xferStr("<memory type=\"");
+#if GDBSTUB_FLASH_WRITE
+		//With flash support, gdb can 'load' into flash. It needs the sector size for that.
+		if (memRegions[i].start==FLASH_MAP_START) {
+			xferStr("flash\" start=\"");
+			xferNum(memRegions[i].start, 1);
+			xferStr("\" length=\"");
+			xferNum(memRegions[i].end-memRegions[i].start, 1);
+			xferStr("\">\n<property name=\"blocksize\">");
+			xferNum(SPI_FLASH_SEC_SIZE, 1);
+			xferStr("</property>\n</memory>\n");
+			continue;
+		}
+#endif
+		xferStr((memRegions[i].flags&MEM_WR)?"ram":"rom");
+		xferStr("\" start=\"");
+		xferNum(memRegions[i].start, 1);
+		xferStr("\" length=\"");
+		xferNum(memRegions[i].end-memRegions[i].start, 1);
+		xferStr("\"/>\n");
+	}
+	xferStr("</memory-map>\n");
+}
+
+//Generate the target description. The registers are the ones in the 'g' packet, in that order.
+static void ATTR_GDBFN xferTargetXml() {
+	const char * const regs[]={"pc", "sar", "litbase", "sr176", "sr208", "ps"};
+	int i;
+	xferStr("<?xml version=\"1.0\"?>\n<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n<target>\n"
+			"<architecture>xtensa</architecture>\n<feature name=\"org.gnu.gdb.xtensa.lx106\">\n");
+	for (i=0; i<22; i++) {
+		xferStr("<reg name=\"");
+		if (i<16) {
+			xferStr("a");
+			xferNum(i, 0);
+		} else {
+			xferStr(regs[i-16]);
+		}
+		xferStr("\" bitsize=\"32\" regnum=\"");
+		xferNum(i, 0);
+		if (i==1) xferStr("\" type=\"data_ptr");
+		if (i==16) xferStr("\" type=\"code_ptr");
+		xferStr("\"/>\n");
+	}
+	xferStr("</feature>\n</target>\n");
+}
+
+#if GDBSTUB_PROFILE_SIZE
+//Generate the profile, in the same format as 'monitor prof dump'. This is for tools that talk to the stub
+//directly; in gdb, use the monitor command.
+static void ATTR_GDBFN xferProfile() {
+	char buf[48];
+	int i;
+	profTotals(buf);
+	xferStr(buf);
+	for (i=0; i<GDBSTUB_PROFILE_SIZE; i++) {
+		if (profHist[i].count==0) continue;
+		profFormat(buf, &profHist[i]);
+		xferStr(buf);
+	}
+}
+#endif
+
+//Handle a qXfer read. Data points to the object name, after 'qXfer:'.
+static int ATTR_GDBFN gdbHandleXfer(unsigned char *data) {
+	void (*gen)()=0;
+	if (strncmp((char*)data, "memory-map:read::", 17)==0) {
+		gen=xferMemoryMap;
+		data+=17;
+	} else if (strncmp((char*)data, "features:read:target.xml:", 25)==0) {
+		gen=xferTargetXml;
+		data+=25;
+#if GDBSTUB_PROFILE_SIZE
+	} else if (strncmp((char*)data, "gdbstub-profile:read::", 22)==0) {
+		gen=xferProfile;
+		data+=22;
+#endif
+	}
+	gdbPacketStart();
+	if (gen==0) {
+		//Don't know that object. Empty reply means we don't support it.
+		gdbPacketEnd();
+		return ST_ERR;
+	}
+	xferOff=gdbGetHexVal(&data, -1);
+	data++; //skip ','
+	xferLen=gdbGetHexVal(&data, -1);
+	xferSend=0;
+	xferPos=0;
+	gen();
+	//'l' tells gdb this is the last chunk.
+	gdbPacketChar((xferOff+xferLen>=xferPos)?'l':'m');
+	xferSend=1;
+	xferPos=0;
+	gen();
+	gdbPacketEnd();
+	return ST_OK;
+}
+
+#if GDBSTUB_FREERTOS
+/*
+FreeRTOS thread support. Gdb tells us where the FreeRTOS task lists are through qSymbol, and the stub
+walks those itself, so 'info threads' doesn't cost hundreds of memory reads. Task registers are read
+from the frame the RTOS saved on the stack of the task when it switched away from it.
+*/
+#define RTOS_CURRENT 0
+#define RTOS_READY 1					//pxReadyTasksLists; the ready lists follow this one
+#define RTOS_NSYMS 7
+static const char * const rtosSymNames[RTOS_NSYMS]={"pxCurrentTCB", "pxReadyTasksLists",
+		"xDelayedTaskList1", "xDelayedTaskList2", "xPendingReadyList",
+		"xSuspendedTaskList", "xTasksWaitingTermination"};
+//What the lists mean for the state of the tasks on them, indexed like rtosSymNames
+static const char * const rtosStates[RTOS_NSYMS]={"Running", "Ready", "Blocked", "Blocked", "Ready",
+		"Suspended", "Deleted"};
+static uint32_t rtosSyms[RTOS_NSYMS];	//Addresses of the symbols, 0 if gdb doesn't know them
+static int rtosSymNext;					//Symbol we're asking gdb for
+static uint32_t rtosRegTask;			//TCB of the task selected with Hg, 0 for the current one
+
+#define RTOS_MAXTASKS 32
+#define RTOS_LIST_SIZE 20				//sizeof(xList): item count, index, 12-byte list end marker
+#define RTOS_TCB_PRIO 44				//Offset of uxPriority in the TCB
+#define RTOS_TCB_NAME 52				//Offset of pcTaskName in the TCB
+
+//Get the TCB of the task that was running when we stopped, or 0 if there is none (yet).
+static uint32_t ATTR_GDBFN rtosCurrentTask() {
+	uint32_t tcb;
+	if (rtosSyms[RTOS_CURRENT]==0) return 0;
+	tcb=readword(rtosSyms[RTOS_CURRENT]);
+	if (!(memRegionFlags(tcb, RTOS_TCB_NAME+GDBSTUB_FREERTOS_TASK_NAME_LEN)&MEM_RD)) return 0;
+	return tcb;
+}
+
+//Collect the TCBs of all tasks in tcbs, and the index of the list they're on in lists. Returns the
+//number of tasks.
+static int ATTR_GDBFN rtosTasks(uint32_t *tcbs, unsigned char *lists) {
+	int n=0, i, l, k;
+	uint32_t list, end, item;
+	tcbs[n]=rtosCurrentTask();
+	lists[n]=RTOS_CURRENT;
+	if (tcbs[n]==0) return 0;
+	n++;
+	for (i=RTOS_READY; i<RTOS_NSYMS; i++) {
+		if (rtosSyms[i]==0) continue;
+		for (l=0; l<((i==RTOS_READY)?GDBSTUB_FREERTOS_PRIORITIES:1); l++) {
+			//Walk the list from xListEnd.pxNext back to xListEnd. Each item has the TCB in pvOwner.
+			list=rtosSyms[i]+l*RTOS_LIST_SIZE;
+			end=list+8;
+			item=readword(end+4);
+			for (k=0; item!=end && k<RTOS_MAXTASKS && n<RTOS_MAXTASKS; k++) {
+				if (!(memRegionFlags(item, 20)&MEM_RD)) break;
+				tcbs[n]=readword(item+12);
+				lists[n]=i;
+				if (tcbs[n]!=tcbs[0] && (memRegionFlags(tcbs[n], RTOS_TCB_NAME)&MEM_RD)) n++;
+				item=readword(item+4);
+			}
+		}
+	}
+	return n;
+}
+
+//Find a task. Returns the index of its list, or -1 if there's no such task.
+static int ATTR_GDBFN rtosFindTask(uint32_t tcb) {
+	uint32_t tcbs[RTOS_MAXTASKS];
+	unsigned char lists[RTOS_MAXTASKS];
+	int i, n=rtosTasks(tcbs, lists);
+	for (i=0; i<n; i++) {
+		if (tcbs[i]==tcb) return lists[i];
+	}
+	return -1;
+}
+
+//Handle a qSymbol packet. We ask gdb for the symbols in rtosSymNames one by one. Data points after
+//'qSymbol:'.
+static void ATTR_GDBFN rtosSymbol(unsigned char *data) {
+	const char *name;
+	if (*data==':' && data[1]==0) {
+		//Gdb offers to look up symbols. Start with the first.
+		rtosSymNext=0;
+	} else if (rtosSymNext<RTOS_NSYMS) {
+		//Reply to the last one we asked for: qSymbol:value:name, value is empty if gdb doesn't know it.
+		rtosSyms[rtosSymNext]=(*data==':')?0:gdbGetHexVal(&data, -1);
+		rtosSymNext++;
+	}
+	gdbPacketStart();
+	if (rtosSymNext<RTOS_NSYMS) {
+		gdbPacketStr("qSymbol:");
+		for (name=rtosSymNames[rtosSymNext]; *name!=0; name++) gdbPacketHex(*name, 8);
+	} else {
+		gdbPacketStr("OK");
+	}
+	gdbPacketEnd();
+}
+
+//Handle qfThreadInfo: send all tasks in one go.
+static void ATTR_GDBFN rtosThreadInfo() {
+	uint32_t tcbs[RTOS_MAXTASKS];
+	unsigned char lists[RTOS_MAXTASKS];
+	int i, n=rtosTasks(tcbs, lists);
+	gdbPacketStart();
+	if (n==0) {
+		//No RTOS, or it hasn't started yet. Gdb will assume there's a single thread.
+		gdbPacketChar('l');
+	} else {
+		gdbPacketChar('m');
+		for (i=0; i<n; i++) {
+			if (i!=0) gdbPacketChar(',');
+			gdbPacketHex(tcbs[i], 32);
+		}
+	}
+	gdbPacketEnd();
+}
+
+//Handle qThreadExtraInfo: send the name and state of a task, hex-encoded.
+static void ATTR_GDBFN rtosThreadExtraInfo(uint32_t tcb) {
+	int i=rtosFindTask(tcb);
+	const char *state;
+	unsigned char c;
+	gdbPacketStart();
+	if (i!=-1) {
+		for (c=0; c<GDBSTUB_FREERTOS_TASK_NAME_LEN && readbyte(tcb+RTOS_TCB_NAME+c)!=0; c++) {
+			gdbPacketHex(readbyte(tcb+RTOS_TCB_NAME+c), 8);
+		}
+		gdbPacketHex(' ', 8);
+		gdbPacketHex('(', 8);
+		for (state=rtosStates[i]; *state!=0; state++) gdbPacketHex(*state, 8);
+		gdbPacketHex(',', 8);
+		gdbPacketHex(' ', 8);
+		gdbPacketHex('p', 8);
+		//Priority, in decimal
+		i=readword(tcb+RTOS_TCB_PRIO);
+		if (i>=10) gdbPacketHex('0'+(i/10)%10, 8);
+		gdbPacketHex('0'+i%10, 8);
+		gdbPacketHex(')', 8);
+	}
+	gdbPacketEnd();
+}
+
+//Returns 1 if gdb selected a task other than the one that was running for register access.
+static int ATTR_GDBFN rtosOtherTask() {
+	return rtosRegTask!=0 && rtosRegTask!=rtosCurrentTask();
+}
+
+//Send the registers of the task selected with Hg. These come from the XTensa_rtos_int_frame_s its
+//pxTopOfStack points to. The frame doesn't have litbase and the special registers; those are sent
+//as unavailable.
+static void ATTR_GDBFN rtosSendRegs() {
+	uint32_t frame=readword(rtosRegTask);
+	int i;
+	gdbPacketStart();
+	for (i=0; i<16; i++) gdbPacketHex(iswap(readword(frame+12+i*4)), 32);
+	gdbPacketHex(iswap(readword(frame+4)), 32);	//pc
+	gdbPacketHex(iswap(readword(frame+76)), 32);	//sar
+	for (i=18; i<21; i++) gdbPacketStr("xxxxxxxx");
+	gdbPacketHex(iswap(readword(frame+8)), 32);	//ps
+	gdbPacketEnd();
+}
+
+//Handle the H and T packets. These take a thread id: -1 means all threads and 0 any thread.
+static void ATTR_GDBFN rtosThreadPacket(unsigned char *cmd) {
+	unsigned char *data=(cmd[0]=='H')?&cmd[2]:&cmd[1];
+	uint32_t tcb=0;
+	int ok=1;
+	if (*data!='-') tcb=gdbGetHexVal(&data, -1);
+	if (tcb!=0 && rtosFindTask(tcb)==-1) ok=0;
+	if (cmd[0]=='H' && cmd[1]=='g' && ok) rtosRegTask=tcb;
+	//We can't resume a single task, so Hc is accepted but doesn't do anything.
+	gdbPacketStart();
+	gdbPacketStr(ok?"OK":"E01");
+	gdbPacketEnd();
+}
+#endif
+
+//Add a register to the stop reply. Num is the number of the register in the 'g' packet.
+static void ATTR_GDBFN sendExpedited(int num, uint32_t val) {
+	gdbPacketHex(num, 8);
+	gdbPacketChar(':');
+	gdbPacketHex(iswap(val), 32);
+	gdbPacketChar(';');
+}
 
 //Send the reason execution is stopped to GDB.
 static void ATTR_GDBFN sendReason() {
-#if 0
-	char *reason=""; //default
-#endif
 	//exception-to-signal mapping
 	char exceptionSignal[]={4,31,11,11,2,6,8,0,6,7,0,0,7,7,7,7};
 	int i=0;
+	rangeEnd=0; //If we were range stepping, that's over now.
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+	//Get any output the program did before it stopped to gdb first.
+	gdbConsoleDrain(1);
+#endif
 	gdbPacketStart();
 	gdbPacketChar('T');
 	if (gdbstub_savedRegs.reason==0xff) {
@@ -302,27 +2297,90 @@ static void ATTR_GDBFN sendReason() {
 	} else {
 		//We stopped because of a debugging exception.
 		gdbPacketHex(5, 8); //sigtrap
-//Current Xtensa GDB versions don't seem to request this, so let's leave it off.
-#if 0
-		if (gdbstub_savedRegs.reason&(1<<0)) reason="break";
-		if (gdbstub_savedRegs.reason&(1<<1)) reason="hwbreak";
-		if (gdbstub_savedRegs.reason&(1<<2)) reason="watch";
-		if (gdbstub_savedRegs.reason&(1<<3)) reason="swbreak";
-		if (gdbstub_savedRegs.reason&(1<<4)) reason="swbreak";
-
-		gdbPacketStr(reason);
-		gdbPacketChar(':');
-		//ToDo: watch: send address
-#endif
+		if ((gdbstub_savedRegs.reason&((1<<3)|(1<<4))) && swBreakpointFind(gdbstub_savedRegs.pc)!=-1) {
+			gdbPacketStr("swbreak:;");
+		} else if (gdbstub_savedRegs.reason&(1<<1)) {
+			gdbPacketStr("hwbreak:;");
+		} else if (gdbstub_savedRegs.reason&(1<<2)) {
+			//Tell gdb which watchpoint it was, so it doesn't have to guess.
+			if (watchType=='3') gdbPacketChar('r');
+			if (watchType=='4') gdbPacketChar('a');
+			gdbPacketStr("watch:");
+			gdbPacketHex(watchAddr, 32);
+			gdbPacketChar(';');
+		}
+	}
+	//Send the registers gdb needs at every stop right away, so it doesn't have to ask for all of them.
+	sendExpedited(0, gdbstub_savedRegs.a0);
+	sendExpedited(1, gdbstub_savedRegs.a1);
+	sendExpedited(16, gdbstub_savedRegs.pc);
+	sendExpedited(21, gdbstub_savedRegs.ps);
+#if GDBSTUB_FREERTOS
+	if (rtosCurrentTask()!=0) {
+		gdbPacketStr("thread:");
+		gdbPacketHex(rtosCurrentTask(), 32);
+		gdbPacketChar(';');
 	}
+#endif
 	gdbPacketEnd();
 }
 
-//Handle a command as received from GDB.
+//Single-step one instruction when the program resumes.
+static void ATTR_GDBFN gdbArmSingleStep() {
+	//Single-stepping can go wrong if an interrupt is pending, especially when it is e.g. a task switch:
+	//the ICOUNT register will overflow in the task switch code. That is why we disable interupts when
+	//doing single-instruction stepping.
+	singleStepPs=gdbstub_savedRegs.ps;
+	gdbstub_savedRegs.ps=(gdbstub_savedRegs.ps & ~0xf)|(XCHAL_DEBUGLEVEL-1);
+	gdbstub_icount_ena_single_step();
+}
+
+//Get ready to resume the program, either by continuing or by single-stepping an instruction. If we
+//are stopped on one of our own breakpoints, the original instruction is put back (or the hardware
+//breakpoint is disabled) and single-stepped first; gdbstub_handle_debug_exception re-inserts the
+//breakpoint after that.
+static int ATTR_GDBFN gdbResume(int step) {
+	int i=swBreakpointFind(gdbstub_savedRegs.pc);
+	if (i!=-1) {
+		swBreakpointDisarm(i);
+	} else if (hwBpAddr!=0 && hwBpAddr==gdbstub_savedRegs.pc) {
+		gdbstub_del_hw_breakpoint(hwBpAddr);
+		i=BP_HW;
+	}
+	if (i!=-1) {
+		stepOverBp=i;
+		stepOverCont=!step;
+	}
+	if (step || i!=-1) gdbArmSingleStep();
+	return ST_CONT;
+}
+
+//Handle a command as received from GDB. Len is the length of the unescaped packet data; binary
+//packets like X can contain zeroes so cmd can't be treated as a string for those.
 static int ATTR_GDBFN gdbHandleCommand(unsigned char *cmd, int len) {
 	//Handle a command
-	int i, j, k;
+	int i, j, k, bps;
+	unsigned int w=0;
+	uint32_t crc;
 	unsigned char *data=cmd+1;
+	unsigned char *ptr;
+#if GDBSTUB_TRACE_BUF_SIZE
+	if (traceCurFrame!=-1 && (cmd[0]=='g' || cmd[0]=='m')) return traceFrameRead(cmd);
+	if (isTracePacket(cmd)) return gdbHandleTrace(cmd, len);
+#endif
+#if GDBSTUB_FREERTOS
+	if (cmd[0]=='g' && rtosOtherTask()) {
+		rtosSendRegs();
+		return ST_OK;
+	}
+	if (cmd[0]=='G' && rtosOtherTask()) {
+		//Writing registers of other tasks isn't supported.
+		gdbPacketStart();
+		gdbPacketStr("E01");
+		gdbPacketEnd();
+		return ST_ERR;
+	}
+#endif
 	if (cmd[0]=='g') {		//send all registers to gdb
 		gdbPacketStart();
 		gdbPacketHex(iswap(gdbstub_savedRegs.a0), 32);
@@ -353,8 +2411,13 @@ static int ATTR_GDBFN gdbHandleCommand(unsigned char *cmd, int len) {
 		data++;
 		j=gdbGetHexVal(&data, -1);
 		gdbPacketStart();
+		//Our breakpoints stay in memory while the program is stopped; send what they replaced.
+		bps=swBreakpointsIn(i, j);
+		//Only load every word once, and take the bytes from that.
 		for (k=0; k<j; k++) {
-			gdbPacketHex(readbyte(i++), 8);
+			if (k==0 || (i&3)==0) w=readword(i);
+			gdbPacketHex(bps?swBreakpointOrigByte(i, w>>((i&3)*8)):(w>>((i&3)*8)), 8);
+			i++;
 		}
 		gdbPacketEnd();
 	} else if (cmd[0]=='M') {	//write memory from gdb
@@ -362,59 +2425,187 @@ static int ATTR_GDBFN gdbHandleCommand(unsigned char *cmd, int len) {
 		data++; //skip ,
 		j=gdbGetHexVal(&data, -1); //length
 		data++; //skip :
-		if (validWrAddr(i) && validWrAddr(i+j)) {
-			for (k=0; k<j; k++) {
-				writeByte(i, gdbGetHexVal(&data, 8));
-				i++;
-			}
-			//Make sure caches are up-to-date. Procedure according to Xtensa ISA document, ISYNC inst desc.
-			asm volatile("ISYNC\nISYNC\n");
-			gdbPacketStart();
+		//Convert the hex data to binary in-place; the binary data always is shorter than the hex.
+		ptr=data;
+		for (k=0; k<j && ptr+2<=cmd+len; k++) data[k]=gdbGetHexVal(&ptr, 8);
+		gdbPacketStart();
+		if (k==j && memWrite(i, data, j)) {
 			gdbPacketStr("OK");
-			gdbPacketEnd();
 		} else {
 			//Trying to do a software breakpoint on a flash proc, perhaps?
-			gdbPacketStart();
 			gdbPacketStr("E01");
-			gdbPacketEnd();
 		}
+		gdbPacketEnd();
+	} else if (cmd[0]=='X') {	//write memory from gdb, binary data
+		i=gdbGetHexVal(&data, -1); //addr
+		data++; //skip ,
+		j=gdbGetHexVal(&data, -1); //length
+		data++; //skip :
+		//gdbReadCommand already removed the }-escapes, so data holds the raw bytes. A zero-length
+		//write is what gdb uses to probe if we support this packet at all.
+		gdbPacketStart();
+		if (j==0 || (data+j<=cmd+len && memWrite(i, data, j))) {
+			gdbPacketStr("OK");
+		} else {
+			gdbPacketStr("E01");
+		}
+		gdbPacketEnd();
+#if GDBSTUB_FLASH_WRITE
+	} else if (strncmp((char*)cmd, "vFlashErase:", 12)==0) {	//Erase flash, before a load
+		data=&cmd[12];
+		i=gdbGetHexVal(&data, -1);
+		data++; //skip ,
+		j=gdbGetHexVal(&data, -1);
+		gdbPacketStart();
+		gdbPacketStr(flashEraseCmd(i, j)?"OK":"E01");
+		gdbPacketEnd();
+	} else if (strncmp((char*)cmd, "vFlashWrite:", 12)==0) {	//Write to flash, binary data
+		data=&cmd[12];
+		i=gdbGetHexVal(&data, -1);
+		data++; //skip :
+		gdbPacketStart();
+		gdbPacketStr(flashWriteCmd(i, data, cmd+len-data)?"OK":"E01");
+		gdbPacketEnd();
+	} else if (strcmp((char*)cmd, "vFlashDone")==0) {	//Load is done; write out what we still have
+		gdbPacketStart();
+		gdbPacketStr(flashDoneCmd()?"OK":"E01");
+		gdbPacketEnd();
+#endif
 	} else if (cmd[0]=='?') {	//Reply with stop reason
 		sendReason();
-//	} else if (strncmp(cmd, "vCont?", 6)==0) {
-//		gdbPacketStart();
-//		gdbPacketStr("vCont;c;s");
-//		gdbPacketEnd();
-	} else if (strncmp((char*)cmd, "vCont;c", 7)==0 || cmd[0]=='c') {	//continue execution
-		return ST_CONT;
-	} else if (strncmp((char*)cmd, "vCont;s", 7)==0 || cmd[0]=='s') {	//single-step instruction
-		//Single-stepping can go wrong if an interrupt is pending, especially when it is e.g. a task switch:
-		//the ICOUNT register will overflow in the task switch code. That is why we disable interupts when
-		//doing single-instruction stepping.
-		singleStepPs=gdbstub_savedRegs.ps;
-		gdbstub_savedRegs.ps=(gdbstub_savedRegs.ps & ~0xf)|(XCHAL_DEBUGLEVEL-1);
-		gdbstub_icount_ena_single_step();
-		return ST_CONT;
+	} else if (strncmp((char*)cmd, "vCont?", 6)==0) {
+		//Gdb only uses vCont if c and C are supported. We ignore the signal for C and S.
+		gdbPacketStart();
+		gdbPacketStr("vCont;c;C;s;S;r");
+		gdbPacketEnd();
+	} else if (strncmp((char*)cmd, "vCont;r", 7)==0) {	//step as long as the PC stays in the given range
+		data=&cmd[7];
+		rangeStart=gdbGetHexVal(&data, -1);
+		data++; //skip ','
+		rangeEnd=gdbGetHexVal(&data, -1);
+		//Anything after this is the thread id, which we don't care about.
+		return gdbResume(1);
+	} else if (strncmp((char*)cmd, "vCont;c", 7)==0 || strncmp((char*)cmd, "vCont;C", 7)==0 || cmd[0]=='c') {	//continue execution
+		return gdbResume(0);
+	} else if (strncmp((char*)cmd, "vCont;s", 7)==0 || strncmp((char*)cmd, "vCont;S", 7)==0 || cmd[0]=='s') {	//single-step instruction
+		return gdbResume(1);
 	} else if (cmd[0]=='q') {	//Extended query
 		if (strncmp((char*)&cmd[1], "Supported", 9)==0) { //Capabilities query
 			gdbPacketStart();
-			gdbPacketStr("swbreak+;hwbreak+;PacketSize=255");
+			//PacketSize is in hex. Keep one byte free for the terminating zero gdbReadCommand adds.
+			gdbPacketStr("swbreak+;hwbreak+;QStartNoAckMode+;ConditionalBreakpoints+;");
+			gdbPacketStr("qXfer:memory-map:read+;qXfer:features:read+;");
+#if GDBSTUB_TRACE_BUF_SIZE
+			gdbPacketStr("ConditionalTracepoints+;tracenz+;");
+#endif
+			gdbPacketStr("PacketSize=");
+			gdbPacketHex(PBUFLEN-1, 16);
+			gdbPacketEnd();
+		} else if (strncmp((char*)&cmd[1], "CRC:", 4)==0) { //CRC of a memory block, for compare-sections
+			data=&cmd[5];
+			i=gdbGetHexVal(&data, -1);
+			data++; //skip ','
+			j=gdbGetHexVal(&data, -1);
+			gdbPacketStart();
+			if (memCrc(i, j, &crc)) {
+				gdbPacketChar('C');
+				gdbPacketHex(crc, 32);
+			} else {
+				gdbPacketStr("E01");
+			}
+			gdbPacketEnd();
+		} else if (strncmp((char*)&cmd[1], "Xfer:", 5)==0) { //Read memory map or target description
+			return gdbHandleXfer(&cmd[6]);
+		} else if (strncmp((char*)&cmd[1], "Rcmd,", 5)==0) { //Monitor command
+			//Convert the hex command to a string, in-place.
+			data=&cmd[6];
+			ptr=data;
+			for (i=0; ptr[0]!=0 && ptr[1]!=0; i++) data[i]=gdbGetHexVal(&ptr, 8);
+			data[i]=0;
+			return gdbHandleMonitor((char*)data);
+#if GDBSTUB_FREERTOS
+		} else if (strncmp((char*)&cmd[1], "Symbol:", 7)==0) { //Symbol lookup; see rtosSymbol
+			rtosSymbol(&cmd[8]);
+		} else if (strcmp((char*)&cmd[1], "fThreadInfo")==0) { //Thread list
+			rtosThreadInfo();
+		} else if (strcmp((char*)&cmd[1], "sThreadInfo")==0) { //Rest of the thread list; we sent it all already
+			gdbPacketStart();
+			gdbPacketChar('l');
+			gdbPacketEnd();
+		} else if (strcmp((char*)&cmd[1], "C")==0) { //Current thread
+			gdbPacketStart();
+			if (rtosCurrentTask()!=0) {
+				gdbPacketStr("QC");
+				gdbPacketHex(rtosCurrentTask(), 32);
+			}
 			gdbPacketEnd();
+		} else if (strncmp((char*)&cmd[1], "ThreadExtraInfo,", 16)==0) { //Thread description
+			data=&cmd[17];
+			rtosThreadExtraInfo(gdbGetHexVal(&data, -1));
+#endif
 		} else {
 			//We don't support other queries.
 			gdbPacketStart();
 			gdbPacketEnd();
 			return ST_ERR;
 		}
-	} else if (cmd[0]=='Z') {	//Set hardware break/watchpoint.
+	} else if (cmd[0]=='Q') {	//Extended set
+		if (strcmp((char*)&cmd[1], "StartNoAckMode")==0) {
+			//The ack for this packet already has been sent; everything after this goes without.
+			gdbPacketStart();
+			gdbPacketStr("OK");
+			gdbPacketEnd();
+			noAckMode=1;
+		} else {
+			gdbPacketStart();
+			gdbPacketEnd();
+			return ST_ERR;
+		}
+#if GDBSTUB_FREERTOS
+	} else if (cmd[0]=='H' || cmd[0]=='T') {	//Select thread, or check if it's alive
+		rtosThreadPacket(cmd);
+#endif
+	} else if (cmd[0]=='D') {	//Detach. Continue, and go back to acking packets for whoever connects next.
+		gdbPacketStart();
+		gdbPacketStr("OK");
+		gdbPacketEnd();
+		noAckMode=0;
+		gdbAttached=0;
+		return ST_CONT;
+	} else if (cmd[0]=='F') {	//Reply to a File-I/O request: Fretcode[,errno][,C]
+		i=1;
+		if (*data=='-') {
+			i=-1;
+			data++;
+		}
+		fileIoResult=i*gdbGetHexVal(&data, -1);
+		fileIoErrno=0;
+		if (*data==',' && data[1]!='C') {
+			data++;
+			fileIoErrno=gdbGetHexVal(&data, -1);
+		}
+		fileIoCtrlC=(*data==',' && data[1]=='C');
+		//No reply; the program just continues.
+		return ST_FILEIO;
+	} else if (cmd[0]=='Z') {	//Set software breakpoint or hardware break/watchpoint.
 		data+=2; //skip 'x,'
 		i=gdbGetHexVal(&data, -1);
 		data++; //skip ','
 		j=gdbGetHexVal(&data, -1);
 		gdbPacketStart();
-		if (cmd[1]=='1') {	//Set breakpoint
-			if (gdbstub_set_hw_breakpoint(i, j)) {
+		//Both kinds of breakpoints can have conditions after the kind. Gdb sends Z again to change these.
+		if (cmd[1]=='0') {	//Set software breakpoint; j is the instruction length
+			if (swBreakpointSet(i, j, BP_GDB) && condSet(&swBreakpoints[swBreakpointFind(i)].cond, data, cmd+len)) {
+				gdbPacketStr("OK");
+			} else {
+				swBreakpointClear(i, BP_GDB);
+				gdbPacketStr("E01");
+			}
+		} else if (cmd[1]=='1') {	//Set breakpoint
+			if (hwBreakpointSet(i, BP_GDB) && condSet(&hwBpCond, data, cmd+len)) {
 				gdbPacketStr("OK");
 			} else {
+				hwBreakpointClear(i, BP_GDB);
 				gdbPacketStr("E01");
 			}
 		} else if (cmd[1]=='2' || cmd[1]=='3' || cmd[1]=='4') { //Set watchpoint
@@ -431,20 +2622,28 @@ static int ATTR_GDBFN gdbHandleCommand(unsigned char *cmd, int len) {
 			if (j==32) mask=0x20;
 			if (j==64) mask=0x00;
 			if (mask!=0 && gdbstub_set_hw_watchpoint(i,mask, access)) {
+				watchAddr=i;
+				watchType=cmd[1];
 				gdbPacketStr("OK");
 			} else {
 				gdbPacketStr("E01");
 			}
 		}
 		gdbPacketEnd();
-	} else if (cmd[0]=='z') {	//Clear hardware break/watchpoint
+	} else if (cmd[0]=='z') {	//Clear software breakpoint or hardware break/watchpoint
 		data+=2; //skip 'x,'
 		i=gdbGetHexVal(&data, -1);
 		data++; //skip ','
 		j=gdbGetHexVal(&data, -1);
 		gdbPacketStart();
-		if (cmd[1]=='1') {	//hardware breakpoint
-			if (gdbstub_del_hw_breakpoint(i)) {
+		if (cmd[1]=='0') {	//software breakpoint
+			if (swBreakpointClear(i, BP_GDB)) {
+				gdbPacketStr("OK");
+			} else {
+				gdbPacketStr("E01");
+			}
+		} else if (cmd[1]=='1') {	//hardware breakpoint
+			if (hwBreakpointClear(i, BP_GDB)) {
 				gdbPacketStr("OK");
 			} else {
 				gdbPacketStr("E01");
@@ -467,53 +2666,263 @@ static int ATTR_GDBFN gdbHandleCommand(unsigned char *cmd, int len) {
 }
 
 
+//States of the incoming packet parser
+#define PST_IDLE 0		//Waiting for a $
+#define PST_BODY 1		//Receiving packet data
+#define PST_ESC 2		//Got a }, the next char is escaped
+#define PST_CHSUM1 3	//Got the #, waiting for the first checksum char
+#define PST_CHSUM2 4	//Waiting for the second checksum char
+
+//Results of feeding a char to the parser
+#define PKT_NONE 0		//No complete packet yet
+#define PKT_OK 1		//Complete packet in cmd[]
+#define PKT_BADCHSUM 2	//Complete packet, but the checksum doesn't match
+#define PKT_OVERFLOW 3	//Complete packet, but it didn't fit in cmd[]
+
+static int pktState=PST_IDLE;			//Parser state
+static int pktLen;						//Length of the data in cmd[] so far
+static int pktOverflow;					//Set if the packet didn't fit in cmd[]
+static unsigned char pktChsum;			//Running checksum of the incoming packet
+static unsigned char pktSentChs[2];		//Checksum chars as sent by gdb
+#if GDBSTUB_CTRLC_BREAK
+static uint32_t pktLastTime;			//WDEV_NOW() when the UART interrupt last got chars
+
+//A packet that stalls for this long (in us) while the program runs is given up on.
+#define PKT_TIMEOUT 500000
+#endif
+
+//Feed one received char to the packet parser. Because the parser keeps its state between calls, this
+//can be called with whatever bytes the UART happens to have, e.g. from an interrupt handler.
+static int ATTR_GDBFN gdbParseChar(unsigned char c) {
+	unsigned char *ptr;
+	if (pktState==PST_IDLE) {
+		if (c=='$') {
+			pktState=PST_BODY;
+			pktLen=0;
+			pktOverflow=0;
+			pktChsum=0;
+		}
+		return PKT_NONE;
+	} else if (pktState==PST_BODY || pktState==PST_ESC) {
+		if (pktState==PST_BODY) {
+			if (c=='#') {	//end of packet, checksum follows
+				cmd[pktLen]=0;
+				pktState=PST_CHSUM1;
+				return PKT_NONE;
+			}
+			if (c=='$') {
+				//Wut, restart packet?
+				pktLen=0;
+				pktOverflow=0;
+				pktChsum=0;
+				return PKT_NONE;
+			}
+			pktChsum+=c;
+			if (c=='}') {		//escape the next char
+				pktState=PST_ESC;
+				return PKT_NONE;
+			}
+		} else {
+			pktChsum+=c;
+			c^=0x20;
+			pktState=PST_BODY;
+		}
+		//If the packet doesn't fit, keep reading (but not storing) it so we stay in sync with gdb.
+		if (pktLen>=PBUFLEN-1) {
+			pktOverflow=1;
+		} else {
+			cmd[pktLen++]=c;
+		}
+		return PKT_NONE;
+	} else if (pktState==PST_CHSUM1) {
+		pktSentChs[0]=c;
+		pktState=PST_CHSUM2;
+		return PKT_NONE;
+	} else {
+		pktSentChs[1]=c;
+		pktState=PST_IDLE;
+		ptr=&pktSentChs[0];
+		if ((unsigned char)gdbGetHexVal(&ptr, 8)!=pktChsum) return PKT_BADCHSUM;
+		if (pktOverflow) return PKT_OVERFLOW;
+		return PKT_OK;
+	}
+}
+
+//Ack a packet the parser completed and handle it.
+//In no-ack mode, packets are neither acked nor nacked; gdb won't resend anything anyway.
+static int ATTR_GDBFN gdbHandlePacket(int pkt) {
+#if GDBSTUB_STATS
+	uint32_t t=WDEV_NOW();
+	int r;
+#endif
+	if (pkt==PKT_BADCHSUM) {
+		STATS_ADD(badChsum, 1);
+		if (!noAckMode) gdbSendChar('-');
+		return ST_ERR;
+	}
+	STATS_ADD(pktsRx, 1);
+	//A qSupported is the first thing a newly connected gdb sends, and it expects an ack for it. If
+	//the previous gdb went away without detaching, we may still be in no-ack mode.
+	if (pkt==PKT_OK && strncmp((char*)cmd, "qSupported", 10)==0) noAckMode=0;
+	//A valid packet means gdb is talking to us at the current baud rate.
+	baudFallbackDiv=0;
+	gdbAttached=1;
+	if (!noAckMode) gdbSendChar('+');
+	if (pkt==PKT_OVERFLOW) {
+		//Checksum is fine, so gdb would not resend it any differently: ack it and tell
+		//gdb we can't handle it instead.
+		gdbPacketStart();
+		gdbPacketStr("E02");
+		gdbPacketEnd();
+		return ST_ERR;
+	}
+#if GDBSTUB_STATS
+	r=gdbHandleCommand(cmd, pktLen);
+	t=WDEV_NOW()-t;
+	//If this was 'monitor stats reset', it doesn't count in the counters it just cleared.
+	if (gdbStats.pktsRx!=0) {
+		gdbStats.cmdTime+=t;
+		if (t>gdbStats.cmdMax) gdbStats.cmdMax=t;
+	}
+	return r;
+#else
+	return gdbHandleCommand(cmd, pktLen);
+#endif
+}
+
 //Lower layer: grab a command packet and check the checksum
 //Calls gdbHandleCommand on the packet if the checksum is OK
 //Returns ST_OK on success, ST_ERR when checksum fails, a 
 //character if it is received instead of the GDB packet
 //start char.
 static int ATTR_GDBFN gdbReadCommand() {
-	unsigned char c;
-	unsigned char chsum=0, rchsum;
-	unsigned char sentchs[2];
-	int p=0;
-	unsigned char *ptr;
-	c=gdbRecvChar();
-	if (c!='$') return c;
-	while(1) {
+	int c;
+	int pkt;
+	do {
 		c=gdbRecvChar();
-		if (c=='#') {	//end of packet, checksum follows
-			cmd[p]=0;
-			break;
-		}
-		chsum+=c;
-		if (c=='$') {
-			//Wut, restart packet?
-			chsum=0;
-			p=0;
-			continue;
-		}
-		if (c=='}') {		//escape the next char
-			c=gdbRecvChar();
-			chsum+=c;
-			c^=0x20;
+		if (c==-1) {
+			pktState=PST_IDLE;
+			return ST_TIMEOUT;
 		}
-		cmd[p++]=c;
-		if (p>=PBUFLEN) return ST_ERR;
-	}
-	//A # has been received. Get and check the received chsum.
-	sentchs[0]=gdbRecvChar();
-	sentchs[1]=gdbRecvChar();
-	ptr=&sentchs[0];
-	rchsum=gdbGetHexVal(&ptr, 8);
-//	os_printf("c %x r %x\n", chsum, rchsum);
-	if (rchsum!=chsum) {
-		gdbSendChar('-');
-		return ST_ERR;
-	} else {
-		gdbSendChar('+');
-		return gdbHandleCommand(cmd, p);
+		if (pktState==PST_IDLE && c=='-') STATS_ADD(naksRx, 1);
+		if (pktState==PST_IDLE && c!='$') return c;
+		pkt=gdbParseChar(c);
+	} while (pkt==PKT_NONE);
+	return gdbHandlePacket(pkt);
+}
+
+//Handle commands until gdb tells us to continue the program.
+static void ATTR_GDBFN gdbWaitForContinue() {
+#if GDBSTUB_STATS
+	uint32_t t=WDEV_NOW(), now, ms, lim;
+	uint64_t us=0;
+	int i, r;
+	//WDEV_NOW() wraps every 71 minutes, and a stop can easily last longer. Add up the time per command.
+	do {
+		r=gdbReadCommand();
+		now=WDEV_NOW();
+		us+=now-t;
+		t=now;
+	} while (r!=ST_CONT);
+	ms=us/1000;
+	gdbStats.stops++;
+	gdbStats.haltTime+=ms;
+	if (ms>gdbStats.haltMax) gdbStats.haltMax=ms;
+	for (i=0, lim=1; i<STATS_BUCKETS-1 && ms>=lim; i++) lim*=10;
+	gdbStats.haltHist[i]++;
+#else
+	while(gdbReadCommand()!=ST_CONT);
+#endif
+}
+
+//Start a File-I/O request to gdb. The UART interrupt is masked until the reply is in, so our handler
+//doesn't eat it. Returns 0 if there's no gdb to send it to.
+static int ATTR_GDBFN gdbFileIoStart(char *call) {
+	if (!gdbAttached) return 0;
+#if GDBSTUB_CTRLC_BREAK
+#if GDBSTUB_FREERTOS
+	_xt_isr_mask(1<<ETS_UART_INUM);
+#else
+	ets_isr_mask(1<<ETS_UART_INUM);
+#endif
+#endif
+	fileIoBusy=1;
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+	gdbConsoleDrain(1);
+#endif
+	gdbPacketStart();
+	gdbPacketChar('F');
+	gdbPacketStr(call);
+	return 1;
+}
+
+//Finish the File-I/O request and handle what gdb sends us (memory reads for write(), writes for read())
+//until the F reply comes. Returns the result of the call, or minus the errno if it failed.
+static int ATTR_GDBFN gdbFileIoEnd() {
+	int r;
+	gdbPacketEnd();
+	//Gdb may have gone away without detaching. Don't wait for it forever.
+	recvTimeout=GDBSTUB_FILEIO_TIMEOUT_MS*1000;
+	do {
+		r=gdbReadCommand();
+	} while (r!=ST_FILEIO && r!=ST_TIMEOUT);
+	recvTimeout=0;
+	fileIoBusy=0;
+#if GDBSTUB_CTRLC_BREAK
+#if GDBSTUB_FREERTOS
+	_xt_isr_unmask(1<<ETS_UART_INUM);
+#else
+	ets_isr_unmask(1<<ETS_UART_INUM);
+#endif
+#endif
+	if (r==ST_TIMEOUT) {
+		gdbAttached=0;
+		return -GDBSTUB_EIO;
 	}
+	//If the user pressed control-C while gdb did the call, stop the program now.
+	if (fileIoCtrlC) gdbstub_do_break();
+	if (fileIoResult==-1) return -fileIoErrno;
+	return fileIoResult;
+}
+
+int ATTR_GDBFN gdbstub_open(const char *path, int flags, int mode) {
+	int len=0;
+	if (!gdbFileIoStart("open,")) return -GDBSTUB_ENODEV;
+	while (path[len]!=0) len++;
+	gdbPacketHex((uint32_t)path, 32);
+	gdbPacketChar('/');
+	gdbPacketHex(len+1, 32); //includes the terminating zero
+	gdbPacketChar(',');
+	gdbPacketHex(flags, 32);
+	gdbPacketChar(',');
+	gdbPacketHex(mode, 32);
+	return gdbFileIoEnd();
+}
+
+int ATTR_GDBFN gdbstub_read(int fd, void *buf, unsigned int count) {
+	if (!gdbFileIoStart("read,")) return -GDBSTUB_ENODEV;
+	gdbPacketHex(fd, 32);
+	gdbPacketChar(',');
+	gdbPacketHex((uint32_t)buf, 32);
+	gdbPacketChar(',');
+	gdbPacketHex(count, 32);
+	return gdbFileIoEnd();
+}
+
+int ATTR_GDBFN gdbstub_write(int fd, const void *buf, unsigned int count) {
+	if (!gdbFileIoStart("write,")) return -GDBSTUB_ENODEV;
+	gdbPacketHex(fd, 32);
+	gdbPacketChar(',');
+	gdbPacketHex((uint32_t)buf, 32);
+	gdbPacketChar(',');
+	gdbPacketHex(count, 32);
+	return gdbFileIoEnd();
+}
+
+int ATTR_GDBFN gdbstub_close(int fd) {
+	if (!gdbFileIoStart("close,")) return -GDBSTUB_ENODEV;
+	gdbPacketHex(fd, 32);
+	return gdbFileIoEnd();
 }
 
 //Get the value of one of the A registers
@@ -562,9 +2971,26 @@ static void ATTR_GDBFN emulLdSt() {
 	}
 }
 
+//Check if gdb sent a control-C. Used while range stepping: interrupts are masked for every step, so
+//the UART interrupt never gets to see it. Anything else that came in isn't for us.
+static int ATTR_GDBFN gdbCtrlCPending() {
+	unsigned char c;
+	while (pktState==PST_IDLE && transport->poll()!=0) {
+		c=transport->recv();
+		STATS_ADD(bytesRx, 1);
+		if (c==0x3) return 1;
+#if GDBSTUB_UART_RX_BUF_SIZE
+		gdbUartRxPut(c);
+#endif
+	}
+	return 0;
+}
+
 //We just caught a debug exception and need to handle it. This is called from an assembly
 //routine in gdbstub-entry.S
 void ATTR_GDBFN gdbstub_handle_debug_exception() {
+	struct bpcond *c;
+	int bp;
 	ets_wdt_disable();
 
 	if (singleStepPs!=-1) {
@@ -574,8 +3000,59 @@ void ATTR_GDBFN gdbstub_handle_debug_exception() {
 		singleStepPs=-1;
 	}
 
+	if (stepOverBp!=-1) {
+		//We just stepped over the instruction one of our breakpoints is on. Put the breakpoint back.
+		if (stepOverBp==BP_HW) {
+			gdbstub_set_hw_breakpoint(hwBpAddr, 1);
+		} else {
+			swBreakpointArm(stepOverBp);
+		}
+		stepOverBp=-1;
+		if (stepOverCont) {
+			//Gdb wanted to continue, not step, so it doesn't need to know about this.
+			ets_wdt_enable();
+			return;
+		}
+	}
+
+	if (transportCtrlC && (gdbstub_savedRegs.reason&0x88)==0x8) {
+		//This is the BREAK in gdbstub_do_break, for a control-C that came in over the transport. Stop
+		//after it, like the UART interrupt stops wherever the program is.
+		transportCtrlC=0;
+		gdbstub_savedRegs.pc+=3;
+		gdbstub_savedRegs.reason=0xff;
+	}
+
+	bp=gdbBreakpointAt(gdbstub_savedRegs.pc, &c);
+#if GDBSTUB_TRACE_BUF_SIZE
+	if ((bp&BP_TRACE) && (gdbstub_savedRegs.reason&0x1a)!=0) {
+		//We ran into a tracepoint. Record a trace frame for it.
+		traceHit(gdbstub_savedRegs.pc);
+	}
+#endif
+	if (rangeEnd!=0) {
+		//We're range stepping. Step the next instruction without bothering gdb, until the PC leaves the
+		//range or we get to a breakpoint we should stop at.
+		if ((gdbstub_savedRegs.reason&0x9f)==0x1 && gdbstub_savedRegs.pc>=rangeStart &&
+					gdbstub_savedRegs.pc<rangeEnd && (!(bp&BP_GDB) || !gdbBreakpointStop(gdbstub_savedRegs.pc, c))) {
+			if (!gdbCtrlCPending()) {
+				gdbResume(1);
+				ets_wdt_enable();
+				return;
+			}
+			//Something like while(!flag); never leaves the range. Stop as if for a control-C.
+			gdbstub_savedRegs.reason=0xff;
+		}
+	} else if ((gdbstub_savedRegs.reason&0x1a)!=0 && bp!=0 && (!(bp&BP_GDB) || !gdbBreakpointStop(gdbstub_savedRegs.pc, c))) {
+		//We hit a breakpoint (BREAK, BREAK.N or IBREAK), but it's only there for a tracepoint, its condition
+		//is false or the hit is ignored. Continue without bothering gdb.
+		gdbResume(0);
+		ets_wdt_enable();
+		return;
+	}
+
 	sendReason();
-	while(gdbReadCommand()!=ST_CONT);
+	gdbWaitForContinue();
 	if ((gdbstub_savedRegs.reason&0x84)==0x4) {
 		//We stopped due to a watchpoint. We can't re-execute the current instruction
 		//because it will happily re-trigger the same watchpoint, so we emulate it 
@@ -584,8 +3061,9 @@ void ATTR_GDBFN gdbstub_handle_debug_exception() {
 	} else if ((gdbstub_savedRegs.reason&0x88)==0x8) {
 		//We stopped due to a BREAK instruction. Skip over it.
 		//Check the instruction first; gdb may have replaced it with the original instruction
-		//if it's one of the breakpoints it set.
-		if (readbyte(gdbstub_savedRegs.pc+2)==0 &&
+		//if it's one of the breakpoints it set. Our own breakpoints are handled by gdbResume.
+		if (swBreakpointFind(gdbstub_savedRegs.pc)==-1 &&
+					readbyte(gdbstub_savedRegs.pc+2)==0 &&
 					(readbyte(gdbstub_savedRegs.pc+1)&0xf0)==0x40 &&
 					(readbyte(gdbstub_savedRegs.pc)&0x0f)==0x00) {
 			gdbstub_savedRegs.pc+=3;
@@ -593,22 +3071,101 @@ void ATTR_GDBFN gdbstub_handle_debug_exception() {
 	} else if ((gdbstub_savedRegs.reason&0x90)==0x10) {
 		//We stopped due to a BREAK.N instruction. Skip over it, after making sure the instruction
 		//actually is a BREAK.N
-		if ((readbyte(gdbstub_savedRegs.pc+1)&0xf0)==0xf0 &&
+		if (swBreakpointFind(gdbstub_savedRegs.pc)==-1 &&
+					(readbyte(gdbstub_savedRegs.pc+1)&0xf0)==0xf0 &&
 					readbyte(gdbstub_savedRegs.pc)==0x2d) {
-			gdbstub_savedRegs.pc+=3;
+			gdbstub_savedRegs.pc+=2;
 		}
 	}
 	ets_wdt_enable();
 }
 
 
+#if GDBSTUB_COREDUMP_ADDR
+/*
+Core dump to flash, for when there's no gdb to tell about a fatal exception. The dump starts with a header
+of 26 words: magic, size of the dump in bytes, exception reason, number of memory regions, and the registers
+in 'g' packet order. The memory regions follow, each as start address, length and the data. The stack is
+saved first, then as much of the rest of DRAM as fits. The header is written last, so a dump that got
+interrupted doesn't look valid. tools/gdbstub-coredump.py converts the dump to an ELF core file.
+*/
+#define COREDUMP_MAGIC 0x31444347		//'GCD1'
+#define COREDUMP_HDR_WORDS 26
+#define COREDUMP_DRAM_START 0x3ffe8000
+#define COREDUMP_DRAM_END 0x40000000
+#define COREDUMP_STACK 0x1000			//Bytes above the stack pointer that are always saved
+
+typedef void resetfntype();
+static resetfntype *romResetVector=(resetfntype *)0x40000080;
+
+static uint32_t coreDumpPos;			//Flash address the next region goes to
+static int coreDumpRegions;				//Amount of regions written
+
+//Add the memory from start to end to the core dump, or as much of it as still fits. Start and end
+//have to be word-aligned.
+static void ATTR_GDBFN coreDumpRegion(uint32_t start, uint32_t end) {
+	uint32_t hdr[2];
+	uint32_t left=GDBSTUB_COREDUMP_ADDR+GDBSTUB_COREDUMP_SIZE-coreDumpPos;
+	uint32_t n;
+	if (end<=start || left<=sizeof(hdr)) return;
+	if (end-start>left-sizeof(hdr)) end=start+((left-sizeof(hdr))&~3);
+	hdr[0]=start;
+	hdr[1]=end-start;
+	spi_flash_write(coreDumpPos, hdr, sizeof(hdr));
+	coreDumpPos+=sizeof(hdr);
+	//Write a sector's worth at a time, so the watchdog can be fed in between.
+	while (start<end) {
+		n=(end-start>SPI_FLASH_SEC_SIZE)?SPI_FLASH_SEC_SIZE:end-start;
+		keepWDTalive();
+		spi_flash_write(coreDumpPos, (uint32_t*)start, n);
+		coreDumpPos+=n;
+		start+=n;
+	}
+	coreDumpRegions++;
+}
+
+//Write the registers and memory to flash and reset. Doesn't return.
+static void ATTR_GDBFN gdbCoreDump() {
+	uint32_t hdr[COREDUMP_HDR_WORDS];
+	uint32_t sp=gdbstub_savedRegs.a1&~3;
+	uint32_t stackEnd;
+	int i;
+	//The hardware watchdog keeps running, and erasing and writing 100K of flash takes a while.
+	for (i=0; i<GDBSTUB_COREDUMP_SIZE; i+=SPI_FLASH_SEC_SIZE) {
+		keepWDTalive();
+		spi_flash_erase_sector((GDBSTUB_COREDUMP_ADDR+i)/SPI_FLASH_SEC_SIZE);
+	}
+	coreDumpPos=GDBSTUB_COREDUMP_ADDR+sizeof(hdr);
+	coreDumpRegions=0;
+	if (sp>=COREDUMP_DRAM_START && sp<COREDUMP_DRAM_END) {
+		stackEnd=(COREDUMP_DRAM_END-sp>COREDUMP_STACK)?sp+COREDUMP_STACK:COREDUMP_DRAM_END;
+		coreDumpRegion(sp, stackEnd);
+		coreDumpRegion(stackEnd, COREDUMP_DRAM_END);
+		coreDumpRegion(COREDUMP_DRAM_START, sp);
+	} else {
+		coreDumpRegion(COREDUMP_DRAM_START, COREDUMP_DRAM_END);
+	}
+	hdr[0]=COREDUMP_MAGIC;
+	hdr[1]=coreDumpPos-GDBSTUB_COREDUMP_ADDR;
+	hdr[2]=gdbstub_savedRegs.reason;
+	hdr[3]=coreDumpRegions;
+	for (i=0; i<22; i++) gdbGetReg(i, &hdr[4+i]);
+	spi_flash_write(GDBSTUB_COREDUMP_ADDR, hdr, sizeof(hdr));
+	romResetVector();
+}
+#endif
+
 #if GDBSTUB_FREERTOS
 //Freetos exception. This routine is called by an assembly routine in gdbstub-entry.S
 void ATTR_GDBFN gdbstub_handle_user_exception() {
 	ets_wdt_disable();
 	gdbstub_savedRegs.reason|=0x80; //mark as an exception reason
+#if GDBSTUB_COREDUMP_ADDR
+	//Nobody to tell about this; save what we can for later.
+	if (!gdbAttached) gdbCoreDump();
+#endif
 	sendReason();
-	while(gdbReadCommand()!=ST_CONT);
+	gdbWaitForContinue();
 	ets_wdt_enable();
 }
 #else
@@ -626,8 +3183,12 @@ static void ATTR_GDBFN gdb_exception_handler(struct XTensa_exception_frame_s *fr
 	gdbstub_savedRegs.reason|=0x80; //mark as an exception reason
 
 	ets_wdt_disable();
+#if GDBSTUB_COREDUMP_ADDR
+	//Nobody to tell about this; save what we can for later.
+	if (!gdbAttached) gdbCoreDump();
+#endif
 	sendReason();
-	while(gdbReadCommand()!=ST_CONT);
+	gdbWaitForContinue();
 	ets_wdt_enable();
 
 	//Copy any changed registers back to the frame the Xtensa HAL uses.
@@ -635,21 +3196,6 @@ static void ATTR_GDBFN gdb_exception_handler(struct XTensa_exception_frame_s *fr
 }
 #endif
 
-#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
-//Replacement putchar1 routine. Instead of spitting out the character directly, it will buffer up to
-//OBUFLEN characters (or up to a \n, whichever comes earlier) and send it out as a gdb stdout packet.
-static void ATTR_GDBFN gdb_semihost_putchar1(char c) {
-	int i;
-	obuf[obufpos++]=c;
-	if (c=='\n' || obufpos==OBUFLEN) {
-		gdbPacketStart();
-		gdbPacketChar('O');
-		for (i=0; i<obufpos; i++) gdbPacketHex(obuf[i], 8);
-		gdbPacketEnd();
-		obufpos=0;
-	}
-}
-#endif
 
 #if !GDBSTUB_FREERTOS
 //The OS-less SDK uses the Xtensa HAL to handle exceptions. We can use those functions to catch any 
@@ -683,21 +3229,93 @@ static void ATTR_GDBINIT install_exceptions() {
 
 #if GDBSTUB_CTRLC_BREAK
 
+//Enter the debugger from the UART interrupt. This happens when gdb sends a control-C (pkt is PKT_NONE)
+//or when a complete packet came in while the program was running, e.g. because gdb (re)connected.
+static void ATTR_GDBFN gdbAsyncStop(int pkt) {
+	int r=ST_OK;
+	if (pkt==PKT_NONE) {
+		sendReason();
+	} else {
+		r=gdbHandlePacket(pkt);
+	}
+	if (r!=ST_CONT) gdbWaitForContinue();
+}
+
+//Read what the UART received, from its interrupt handler. Sets *doDebug if there's a control-C, and
+//feeds the rest to the packet parser. Stops reading when a packet is complete; gdbReadCommand will pick
+//up anything after it. Chars outside of packets are passed on to the program through ibuf, or thrown
+//away if that's disabled. Returns the result of the parser.
+static int ATTR_GDBFN gdbUartRxInt(int *doDebug) {
+	int fifolen, pkt=PKT_NONE;
+	unsigned char c;
+	fifolen=(READ_PERI_REG(UART_STATUS(0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
+#if GDBSTUB_UART_RX_BUF_SIZE
+	unsigned int rxHead=ibufHead;
+#endif
+	//Line noise or a gdb that went away can leave half a packet behind. Don't let that keep a control-C
+	//from being seen forever.
+	if (fifolen!=0 && pktState!=PST_IDLE && WDEV_NOW()-pktLastTime>PKT_TIMEOUT) {
+		pktState=PST_IDLE;
+#if GDBSTUB_UART_RX_BUF_SIZE
+		ibufHead=ibufPend;
+#endif
+	}
+	while (fifolen!=0 && pkt==PKT_NONE) {
+		c=READ_PERI_REG(UART_FIFO(0)) & 0xFF;
+		STATS_ADD(bytesRx, 1);
+		if (pktState==PST_IDLE && c==0x3) {
+			*doDebug=1;
+#if GDBSTUB_UART_RX_BUF_SIZE
+		} else if (pktState==PST_IDLE && (c!='$' || !gdbAttached)) {
+			//Without gdb, a '$' is just another char for the program.
+			gdbUartRxPut(c);
+#endif
+		} else {
+#if GDBSTUB_UART_RX_BUF_SIZE
+			//Hold on to the chars of the packet. A new packet forgets chars a stopped program left held;
+			//the parser starting over means the chars so far weren't a packet.
+			if (c=='$' && pktState==PST_IDLE) ibufPend=ibufHead;
+			if (c=='$' && pktState==PST_BODY) ibufHead=ibufPend;
+			gdbUartRxHold(c);
+#endif
+			pkt=gdbParseChar(c);
+#if GDBSTUB_UART_RX_BUF_SIZE
+			if (pkt==PKT_BADCHSUM) {
+				ibufHead=ibufPend;
+			} else if (pkt!=PKT_NONE) {
+				ibufPend=ibufHead;
+			}
+#endif
+			if (pkt==PKT_BADCHSUM) {
+				//Ask for it again, but don't stop the program: it may well be noise and not gdb.
+				STATS_ADD(badChsum, 1);
+				if (!noAckMode) gdbSendChar('-');
+				pkt=PKT_NONE;
+			}
+		}
+		fifolen--;
+	}
+	pktLastTime=WDEV_NOW();
+	WRITE_PERI_REG(UART_INT_CLR(0), UART_RXFIFO_FULL_INT_CLR|UART_RXFIFO_TOUT_INT_CLR);
+#if GDBSTUB_UART_RX_BUF_SIZE
+	if (ibufHead!=rxHead && ibufCallback!=NULL) ibufCallback();
+#endif
+	return pkt;
+}
+
 #if !GDBSTUB_FREERTOS
 
 static void ATTR_GDBFN uart_hdlr(void *arg, void *frame) {
-	int doDebug=0, fifolen=0;
+	int doDebug=0, pkt;
 	//Save the extra registers the Xtensa HAL doesn't save
 	gdbstub_save_extra_sfrs_for_exception();
 
-	fifolen=(READ_PERI_REG(UART_STATUS(0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
-	while (fifolen!=0) {
-		if ((READ_PERI_REG(UART_FIFO(0)) & 0xFF)==0x3) doDebug=1; //Check if any of the chars is control-C. Throw away rest.
-		fifolen--;
-	}
-	WRITE_PERI_REG(UART_INT_CLR(0), UART_RXFIFO_FULL_INT_CLR|UART_RXFIFO_TOUT_INT_CLR);
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+	if (READ_PERI_REG(UART_INT_ST(0))&UART_TXFIFO_EMPTY_INT_ST) gdbConsoleTxInt();
+#endif
+	pkt=gdbUartRxInt(&doDebug);
 
-	if (doDebug) {
+	if (doDebug || pkt!=PKT_NONE) {
 		//Copy registers the Xtensa HAL did save to gdbstub_savedRegs
 		os_memcpy(&gdbstub_savedRegs, frame, 19*4);
 		gdbstub_savedRegs.a1=(uint32_t)frame+EXCEPTION_GDB_SP_OFFSET;
@@ -705,8 +3323,7 @@ static void ATTR_GDBFN uart_hdlr(void *arg, void *frame) {
 		gdbstub_savedRegs.reason=0xff; //mark as user break reason
 	
 		ets_wdt_disable();
-		sendReason();
-		while(gdbReadCommand()!=ST_CONT);
+		gdbAsyncStop(pkt);
 		ets_wdt_enable();
 		//Copy any changed registers back to the frame the Xtensa HAL uses.
 		os_memcpy(frame, &gdbstub_savedRegs, 19*4);
@@ -716,22 +3333,25 @@ static void ATTR_GDBFN uart_hdlr(void *arg, void *frame) {
 static void ATTR_GDBINIT install_uart_hdlr() {
 	ets_isr_attach(ETS_UART_INUM, uart_hdlr, NULL);
 	SET_PERI_REG_MASK(UART_INT_ENA(0), UART_RXFIFO_FULL_INT_ENA|UART_RXFIFO_TOUT_INT_ENA);
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+	//Get a TX interrupt when there's room for a full console packet in the FIFO.
+	WRITE_PERI_REG(UART_CONF1(0), (READ_PERI_REG(UART_CONF1(0))&~(UART_TXFIFO_EMPTY_THRHD<<UART_TXFIFO_EMPTY_THRHD_S))|
+			(0x10<<UART_TXFIFO_EMPTY_THRHD_S));
+#endif
 	ets_isr_unmask((1<<ETS_UART_INUM)); //enable uart interrupt
 }
 
 #else
 
 void ATTR_GDBFN gdbstub_handle_uart_int(struct XTensa_rtos_int_frame_s *frame) {
-	int doDebug=0, fifolen=0, x;
+	int doDebug=0, x, pkt;
 
-	fifolen=(READ_PERI_REG(UART_STATUS(0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
-	while (fifolen!=0) {
-		if ((READ_PERI_REG(UART_FIFO(0)) & 0xFF)==0x3) doDebug=1; //Check if any of the chars is control-C. Throw away rest.
-		fifolen--;
-	}
-	WRITE_PERI_REG(UART_INT_CLR(0), UART_RXFIFO_FULL_INT_CLR|UART_RXFIFO_TOUT_INT_CLR);
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+	if (READ_PERI_REG(UART_INT_ST(0))&UART_TXFIFO_EMPTY_INT_ST) gdbConsoleTxInt();
+#endif
+	pkt=gdbUartRxInt(&doDebug);
 
-	if (doDebug) {
+	if (doDebug || pkt!=PKT_NONE) {
 		//Copy registers the Xtensa HAL did save to gdbstub_savedRegs
 		gdbstub_savedRegs.pc=frame->pc;
 		gdbstub_savedRegs.ps=frame->ps;
@@ -745,8 +3365,7 @@ void ATTR_GDBFN gdbstub_handle_uart_int(struct XTensa_rtos_int_frame_s *frame) {
 		gdbstub_savedRegs.reason=0xff; //mark as user break reason
 	
 //		ets_wdt_disable();
-		sendReason();
-		while(gdbReadCommand()!=ST_CONT);
+		gdbAsyncStop(pkt);
 //		ets_wdt_enable();
 		//Copy any changed registers back to the frame the Xtensa HAL uses.
 		frame->pc=gdbstub_savedRegs.pc;
@@ -761,6 +3380,11 @@ void ATTR_GDBFN gdbstub_handle_uart_int(struct XTensa_rtos_int_frame_s *frame) {
 static void ATTR_GDBINIT install_uart_hdlr() {
 	_xt_isr_attach(ETS_UART_INUM, gdbstub_uart_entry);
 	SET_PERI_REG_MASK(UART_INT_ENA(0), UART_RXFIFO_FULL_INT_ENA|UART_RXFIFO_TOUT_INT_ENA);
+#if GDBSTUB_REDIRECT_CONSOLE_OUTPUT
+	//Get a TX interrupt when there's room for a full console packet in the FIFO.
+	WRITE_PERI_REG(UART_CONF1(0), (READ_PERI_REG(UART_CONF1(0))&~(UART_TXFIFO_EMPTY_THRHD<<UART_TXFIFO_EMPTY_THRHD_S))|
+			(0x10<<UART_TXFIFO_EMPTY_THRHD_S));
+#endif
 	_xt_isr_unmask((1<<ETS_UART_INUM)); //enable uart interrupt
 }
 
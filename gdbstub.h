@@ -7,6 +7,78 @@ extern "C" {
 
 void gdbstub_init();
 
+/*
+The stub talks to gdb over UART0. To use another link, give gdbstub_set_transport these functions; NULL
+goes back to UART0. They're called while the program is stopped, with interrupts disabled and possibly
+with the flash cache off, so they have to be in IRAM and can't wait for interrupts or other tasks. Console
+output while the program runs and 'monitor baud' only work over UART0. The stub only sees a Ctrl-C that
+comes in over another link while the program runs if the code that receives for it calls
+gdbstub_transport_ctrlc; it stops the program as if gdb interrupted it. Call it from normal code, not
+from an interrupt.
+*/
+struct gdbstub_transport {
+	int (*poll)(void);		//Return the number of received chars that can be read right away
+	int (*recv)(void);		//Return the next received char; only called after poll returned non-zero
+	void (*send)(char c);	//Send a char, waiting for room if needed
+	void (*flush)(void);	//Send out anything buffered; called before the stub waits for gdb
+};
+void gdbstub_set_transport(const struct gdbstub_transport *t);
+void gdbstub_transport_ctrlc(void);
+
+/*
+Read serial data that came in while the stub has the UART interrupt (GDBSTUB_CTRLC_BREAK), if
+GDBSTUB_UART_RX_BUF_SIZE is set. gdbstub_uart_read doesn't wait; it returns the amount of chars it put in
+buf, 0 if there were none. The callback is called from the UART interrupt when there's new data, so it
+should be short and not call gdbstub_uart_read itself; e.g. post a task or set a flag.
+*/
+int gdbstub_uart_read(void *buf, int len);
+void gdbstub_uart_set_rx_callback(void (*cb)(void));
+
+/*
+Access files on the machine gdb runs on, using the gdb File-I/O protocol. These work like their POSIX
+counterparts, but return minus the error number (one of the GDBSTUB_E* values) on failure. Paths are
+relative to the directory gdb was started in. The calls wait until gdb has done them, so only use these
+from normal code (not from interrupts), while the program runs with gdb attached. Without gdb, they fail
+with -GDBSTUB_ENODEV. If gdb went away without detaching and doesn't answer within
+GDBSTUB_FILEIO_TIMEOUT_MS, they fail with -GDBSTUB_EIO, and later calls with -GDBSTUB_ENODEV.
+*/
+int gdbstub_open(const char *path, int flags, int mode);
+int gdbstub_read(int fd, void *buf, unsigned int count);
+int gdbstub_write(int fd, const void *buf, unsigned int count);
+int gdbstub_close(int fd);
+
+//Flags for gdbstub_open. Mode is the usual octal permissions, e.g. 0644.
+#define GDBSTUB_O_RDONLY	0x0
+#define GDBSTUB_O_WRONLY	0x1
+#define GDBSTUB_O_RDWR		0x2
+#define GDBSTUB_O_APPEND	0x8
+#define GDBSTUB_O_CREAT		0x200
+#define GDBSTUB_O_TRUNC		0x400
+#define GDBSTUB_O_EXCL		0x800
+
+//Error numbers, as gdb sends them
+#define GDBSTUB_EPERM		1
+#define GDBSTUB_ENOENT		2
+#define GDBSTUB_EINTR		4
+#define GDBSTUB_EIO		5
+#define GDBSTUB_EBADF		9
+#define GDBSTUB_EACCES		13
+#define GDBSTUB_EFAULT		14
+#define GDBSTUB_EBUSY		16
+#define GDBSTUB_EEXIST		17
+#define GDBSTUB_ENODEV		19
+#define GDBSTUB_ENOTDIR		20
+#define GDBSTUB_EISDIR		21
+#define GDBSTUB_EINVAL		22
+#define GDBSTUB_ENFILE		23
+#define GDBSTUB_EMFILE		24
+#define GDBSTUB_EFBIG		27
+#define GDBSTUB_ENOSPC		28
+#define GDBSTUB_ESPIPE		29
+#define GDBSTUB_EROFS		30
+#define GDBSTUB_ENAMETOOLONG	91
+#define GDBSTUB_EUNKNOWN	9999
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,18 @@
+//Stand-in for the SDK's c_types.h, for the host build.
+#ifndef C_TYPES_H
+#define C_TYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t uint8;
+typedef int8_t sint8;
+typedef uint16_t uint16;
+typedef int16_t sint16;
+typedef uint32_t uint32;
+typedef int32_t sint32;
+
+#define ICACHE_FLASH_ATTR
+#define BIT(nr) (1UL<<(nr))
+
+#endif
@@ -0,0 +1 @@
+//Stand-in for the SDK's eagle_soc.h, for the host build. Gdbstub defines the registers it uses itself.
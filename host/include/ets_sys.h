@@ -0,0 +1,24 @@
+//Stand-in for the SDK's ets_sys.h, for the host build. Register accesses go to the simulated
+//hardware in host/sim.c.
+#ifndef ETS_SYS_H
+#define ETS_SYS_H
+
+#include "c_types.h"
+
+uint32_t sim_read(uint32_t addr);
+void sim_write(uint32_t addr, uint32_t val);
+
+#define READ_PERI_REG(addr) sim_read((uint32_t)(addr))
+#define WRITE_PERI_REG(addr, val) sim_write((uint32_t)(addr), (uint32_t)(val))
+#define SET_PERI_REG_MASK(reg, mask) WRITE_PERI_REG((reg), (READ_PERI_REG(reg)|(mask)))
+#define CLEAR_PERI_REG_MASK(reg, mask) WRITE_PERI_REG((reg), (READ_PERI_REG(reg)&(~(mask))))
+
+void ets_isr_attach(int inum, void *fn, void *arg);
+void ets_isr_mask(uint32_t mask);
+void ets_isr_unmask(uint32_t mask);
+void ets_wdt_disable(void);
+void ets_wdt_enable(void);
+
+#define XCHAL_DEBUGLEVEL 2
+
+#endif
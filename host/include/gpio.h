@@ -0,0 +1 @@
+//Stand-in for the SDK's gpio.h, for the host build. Gdbstub doesn't use anything from it.
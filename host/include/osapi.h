@@ -0,0 +1,19 @@
+//Stand-in for the SDK's osapi.h, for the host build. Like on the ESP, os_printf goes through the
+//function given to os_install_putc1.
+#ifndef OSAPI_H
+#define OSAPI_H
+
+#include <string.h>
+
+int sim_printf(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+#define os_printf sim_printf
+#define os_printf_plus sim_printf
+#define os_memcpy memcpy
+#define os_memset memset
+#define os_memcmp memcmp
+#define os_strlen strlen
+
+void os_install_putc1(void (*p)(char c));
+
+#endif
@@ -0,0 +1 @@
+//Stand-in for the SDK's user_interface.h, for the host build. Gdbstub doesn't use anything from it.
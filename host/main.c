@@ -0,0 +1,59 @@
+/*
+Host build of gdbstub: runs the stub on a simulated ESP8266, with UART0 on a pseudo-terminal.
+
+  gdbstub-host [-s | -p port] [-f flashfile]
+
+Without -s it prints the name of the pty; connect gdb to it with 'target remote /dev/pts/N'. With -s,
+UART0 is stdin and stdout instead, for scripts. With -p, the stub talks to gdb over TCP instead of UART0,
+through gdbstub_set_transport; connect with 'target remote :port'. -f keeps the simulated flash in a file.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "gdbstub.h"
+
+int main(int argc, char **argv) {
+	char pty[64];
+	int c, useStdio=0, port=-1;
+	char *flashFile=NULL;
+	while ((c=getopt(argc, argv, "sp:f:"))!=-1) {
+		if (c=='s') {
+			useStdio=1;
+		} else if (c=='p') {
+			port=atoi(optarg);
+		} else if (c=='f') {
+			flashFile=optarg;
+		} else {
+			fprintf(stderr, "Usage: %s [-s | -p port] [-f flashfile]\n", argv[0]);
+			return 1;
+		}
+	}
+	sim_init();
+	if (flashFile!=NULL && sim_flash_file(flashFile)<0) {
+		perror(flashFile);
+		return 1;
+	}
+	if (port>=0) {
+		port=sim_tcp_listen(port);
+		if (port<0) {
+			perror("gdbstub-host: listen");
+			return 1;
+		}
+		fprintf(stderr, "gdbstub-host: listening on port %d\n", port);
+		gdbstub_set_transport(&sim_tcp_transport);
+	} else if (useStdio) {
+		sim_uart_open(0, 1);
+	} else {
+		if (sim_uart_open_pty(pty, sizeof(pty))<0) {
+			perror("gdbstub-host: pty");
+			return 1;
+		}
+		fprintf(stderr, "gdbstub-host: UART0 is %s\n", pty);
+	}
+	sim_target_init();
+	gdbstub_init();
+	sim_run(-1);
+	return 0;
+}
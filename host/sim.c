@@ -0,0 +1,454 @@
+/*
+Simulated ESP8266 hardware for the host build of gdbstub: the memory map, the peripheral registers the
+stub uses, UART0, the SPI flash, the interrupt controller and WDEV_NOW. There's also a TCP link to gdb,
+which the stub can use instead of UART0 through its transport interface.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sim.h"
+#include "gdbstub.h"
+#include "ets_sys.h"
+#include "osapi.h"
+#include "spi_flash.h"
+
+//The registers we give a meaning; the rest of 0x60000000-0x60002000 is plain storage.
+#define REG_PERI_START		0x60000000
+#define REG_PERI_END		0x60002000
+#define REG_UART0_FIFO		0x60000000
+#define REG_UART0_INT_ST	0x60000008
+#define REG_UART0_INT_ENA	0x6000000c
+#define REG_UART0_INT_CLR	0x60000010
+#define REG_UART0_STATUS	0x6000001c
+#define REG_FRC1_LOAD		0x60000600
+#define REG_FRC1_CTRL		0x60000608
+#define REG_WDEV_NOW		0x3ff20c00
+
+#define UART_INT_RX			(BIT(0)|BIT(8))	//RXFIFO_FULL, RXFIFO_TOUT
+#define UART_INT_TXEMPTY	BIT(1)
+#define FRC1_ENABLE			BIT(7)
+#define ROM_RESET_VECTOR	0x40000080
+
+static uint32_t regs[(REG_PERI_END-REG_PERI_START)/4];
+static struct timespec startTime;
+
+//UART0. Received chars wait in rxBuf until the stub reads them from the FIFO register; sent chars
+//collect in txBuf until the stub checks the UART status, which it does before it waits for gdb.
+static int uartIn=-1, uartOut=-1;
+static unsigned char rxBuf[4096];
+static unsigned int rxHead, rxTail;
+static unsigned char txBuf[1<<20];
+static int txLen;
+static int emptyPolls;					//Status reads in a row that found the RX FIFO empty
+static uint32_t lastFill;				//sim_now() when we last checked the fd for chars
+int (*sim_uart_refill)(void);
+jmp_buf *sim_done;
+
+//The TCP link. Like UART0, sent chars collect in tcpTxBuf until the stub is going to wait for gdb.
+static int tcpListen=-1, tcpFd=-1;
+static unsigned char tcpRxBuf[4096];
+static int tcpRxPos, tcpRxLen;
+static unsigned char tcpTxBuf[4096];
+static int tcpTxLen;
+static int tcpWaiting;					//The stub flushed and waits for gdb, so polling may block a bit
+
+static sim_isr_t isrFn[32];
+static void *isrArg[32];
+static uint32_t isrMask;
+static uint32_t frc1Next;				//sim_now() at which the FRC1 timer fires next
+
+static unsigned char flash[SIM_FLASH_SIZE];
+static int flashFd=-1;
+int sim_flash_erases, sim_flash_writes;
+
+static void (*putc1)(char c);
+
+
+uint32_t sim_now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec-startTime.tv_sec)*1000000+(t.tv_nsec-startTime.tv_nsec)/1000;
+}
+
+//The simulation is over: there's no more input, or the program reset.
+static void simDone(int why) {
+	sim_uart_flush();
+	if (sim_done!=NULL) longjmp(*sim_done, why);
+	exit(0);
+}
+
+
+//Read what came in on the fd, waiting up to ms milliseconds if nothing is there yet.
+static void uartFill(int ms) {
+	unsigned char buf[sizeof(rxBuf)];
+	struct pollfd p={uartIn, POLLIN, 0};
+	int n=sizeof(rxBuf)-(rxHead-rxTail);
+	lastFill=sim_now();
+	if (uartIn<0 || n==0 || poll(&p, 1, ms)<=0) return;
+	n=read(uartIn, buf, n);
+	if (n==0) simDone(1);
+	if (n>0) sim_uart_rx(buf, n);
+}
+
+void sim_uart_open(int infd, int outfd) {
+	uartIn=infd;
+	uartOut=outfd;
+}
+
+//Open a pseudo-terminal for gdb to connect to and put its name in name. We keep the slave side open
+//ourselves, so the master doesn't see a hangup while gdb isn't connected.
+int sim_uart_open_pty(char *name, int len) {
+	struct termios t;
+	int fd, slave;
+	fd=posix_openpt(O_RDWR|O_NOCTTY);
+	if (fd<0 || grantpt(fd)<0 || unlockpt(fd)<0 || ptsname_r(fd, name, len)!=0) return -1;
+	slave=open(name, O_RDWR|O_NOCTTY);
+	if (slave<0) return -1;
+	tcgetattr(slave, &t);
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+	sim_uart_open(fd, fd);
+	return fd;
+}
+
+void sim_uart_flush() {
+	int n, i=0;
+	if (uartOut<0) return;
+	while (i<txLen) {
+		n=write(uartOut, txBuf+i, txLen-i);
+		if (n<=0) break;
+		i+=n;
+	}
+	txLen=0;
+}
+
+void sim_uart_rx(const void *data, int len) {
+	const unsigned char *d=data;
+	while (len-- && rxHead-rxTail<sizeof(rxBuf)) rxBuf[rxHead++%sizeof(rxBuf)]=*d++;
+}
+
+int sim_uart_tx(void *buf, int len) {
+	if (len>txLen) len=txLen;
+	memcpy(buf, txBuf, len);
+	memmove(txBuf, txBuf+len, txLen-len);
+	txLen-=len;
+	return len;
+}
+
+int sim_uart_rx_pending() {
+	if (rxHead==rxTail && uartIn>=0 && sim_now()-lastFill>1000) uartFill(0);
+	return rxHead-rxTail;
+}
+
+//Give gdb a chance to send something while the program runs. In memory mode that's the refill function.
+int sim_uart_wait(int ms) {
+	sim_uart_flush();
+	if (rxHead==rxTail && uartIn>=0) uartFill(ms);
+	if (rxHead==rxTail && uartIn<0 && sim_uart_refill!=NULL) sim_uart_refill();
+	return rxHead-rxTail;
+}
+
+//The stub keeps reading the status while it waits for gdb. Send what it has sent so far, then block for
+//a bit instead of spinning, or in memory mode, ask for more input.
+static void uartStarved() {
+	sim_uart_flush();
+	if (uartIn>=0) {
+		uartFill(10);
+	} else if (sim_uart_refill==NULL || !sim_uart_refill()) {
+		simDone(1);
+	}
+}
+
+static uint32_t uartStatus() {
+	int n;
+	if (rxHead==rxTail && uartIn>=0 && sim_now()-lastFill>1000) uartFill(0);
+	if (rxHead==rxTail && ++emptyPolls>=3) {
+		emptyPolls=0;
+		uartStarved();
+	}
+	n=rxHead-rxTail;
+	//The RX count is 8 bits wide. The TX FIFO is always empty: what the stub sends is buffered and goes
+	//out when it waits for gdb, or every so often while the program runs.
+	return (n>127)?127:n;
+}
+
+
+//Listen for gdb on port, on the loopback interface only; 0 picks a free port. Returns the port.
+int sim_tcp_listen(int port) {
+	struct sockaddr_in sa;
+	socklen_t len=sizeof(sa);
+	int on=1;
+	tcpListen=socket(AF_INET, SOCK_STREAM, 0);
+	if (tcpListen<0) return -1;
+	setsockopt(tcpListen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family=AF_INET;
+	sa.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	sa.sin_port=htons(port);
+	if (bind(tcpListen, (struct sockaddr*)&sa, sizeof(sa))<0 || listen(tcpListen, 1)<0 ||
+			getsockname(tcpListen, (struct sockaddr*)&sa, &len)<0) return -1;
+	return ntohs(sa.sin_port);
+}
+
+//Wait until gdb connects. What the stub sent before that is dropped; gdb asks for the stop reason anyway.
+static void tcpAccept() {
+	int on=1;
+	tcpTxLen=0;
+	tcpFd=accept(tcpListen, NULL, NULL);
+	if (tcpFd<0) {
+		perror("gdbstub-host: accept");
+		exit(1);
+	}
+	setsockopt(tcpFd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+//Read what gdb sent, waiting up to ms milliseconds if nothing is there yet. The simulation is over
+//when gdb hangs up.
+static void tcpFill(int ms) {
+	struct pollfd p={tcpFd, POLLIN, 0};
+	int n;
+	if (tcpFd<0 || tcpRxPos<tcpRxLen || poll(&p, 1, ms)<=0) return;
+	n=recv(tcpFd, tcpRxBuf, sizeof(tcpRxBuf), 0);
+	if (n<=0) simDone(1);
+	tcpRxPos=0;
+	tcpRxLen=n;
+}
+
+static int tcpPoll() {
+	tcpFill(tcpWaiting?10:0);
+	return tcpRxLen-tcpRxPos;
+}
+
+static int tcpRecv() {
+	tcpWaiting=0;
+	return tcpRxBuf[tcpRxPos++];
+}
+
+static void tcpSendOut() {
+	int n, i=0;
+	if (tcpFd<0) return;
+	while (i<tcpTxLen) {
+		n=send(tcpFd, tcpTxBuf+i, tcpTxLen-i, MSG_NOSIGNAL);
+		if (n<=0) break;
+		i+=n;
+	}
+	tcpTxLen=0;
+}
+
+static void tcpSend(char c) {
+	if (tcpTxLen==sizeof(tcpTxBuf)) tcpSendOut();
+	tcpTxBuf[tcpTxLen++]=c;
+}
+
+static void tcpFlush() {
+	if (tcpFd<0) tcpAccept();
+	tcpSendOut();
+	tcpWaiting=1;
+}
+
+const struct gdbstub_transport sim_tcp_transport={
+	tcpPoll, tcpRecv, tcpSend, tcpFlush
+};
+
+//While the program runs, only a control-C from gdb means something: stop the program, as the UART
+//interrupt would. Gdb's acks for the last replies before the program went on are for nobody; anything
+//else waits until the stub reads it.
+int sim_tcp_wait(int ms) {
+	tcpSendOut();
+	while (tcpRxPos<tcpRxLen && (tcpRxBuf[tcpRxPos]=='+' || tcpRxBuf[tcpRxPos]=='-')) tcpRxPos++;
+	tcpFill(ms);
+	if (tcpRxPos<tcpRxLen && tcpRxBuf[tcpRxPos]==0x3) {
+		tcpRxPos++;
+		gdbstub_transport_ctrlc();
+	}
+	return tcpRxLen-tcpRxPos;
+}
+
+
+//Registers go through here; see ets_sys.h. Anything that isn't a register we simulate is memory.
+uint32_t sim_read(uint32_t addr) {
+	uint32_t v;
+	switch (addr) {
+	case REG_WDEV_NOW:
+		return sim_now();
+	case REG_UART0_STATUS:
+		return uartStatus();
+	case REG_UART0_FIFO:
+		emptyPolls=0;
+		return (rxHead!=rxTail)?rxBuf[rxTail++%sizeof(rxBuf)]:0;
+	case REG_UART0_INT_ST:
+		v=regs[(REG_UART0_INT_ENA-REG_PERI_START)/4];
+		return (rxHead!=rxTail?(v&UART_INT_RX):0)|(v&UART_INT_TXEMPTY);
+	}
+	if (addr>=REG_PERI_START && addr<REG_PERI_END) return regs[(addr-REG_PERI_START)/4];
+	return *(volatile uint32_t*)(uintptr_t)addr;
+}
+
+void sim_write(uint32_t addr, uint32_t val) {
+	switch (addr) {
+	case REG_UART0_FIFO:
+		emptyPolls=0;
+		if (txLen==sizeof(txBuf)) sim_uart_flush();
+		if (txLen<sizeof(txBuf)) txBuf[txLen++]=val;
+		return;
+	case REG_UART0_INT_CLR:
+		return;
+	case REG_FRC1_CTRL:
+		frc1Next=sim_now();
+		break;
+	}
+	if (addr>=REG_PERI_START && addr<REG_PERI_END) {
+		regs[(addr-REG_PERI_START)/4]=val;
+	} else {
+		*(volatile uint32_t*)(uintptr_t)addr=val;
+	}
+}
+
+
+void ets_isr_attach(int inum, void *fn, void *arg) {
+	isrFn[inum]=(sim_isr_t)fn;
+	isrArg[inum]=arg;
+}
+
+void ets_isr_mask(uint32_t mask) {
+	isrMask&=~mask;
+}
+
+void ets_isr_unmask(uint32_t mask) {
+	isrMask|=mask;
+}
+
+sim_isr_t sim_isr(int inum, void **arg) {
+	if (!(isrMask&(1<<inum))) return NULL;
+	*arg=isrArg[inum];
+	return isrFn[inum];
+}
+
+int sim_int_pending(int inum) {
+	uint32_t v;
+	if (inum==SIM_INUM_UART) {
+		v=regs[(REG_UART0_INT_ENA-REG_PERI_START)/4];
+		return ((v&UART_INT_RX) && sim_uart_rx_pending()) || (v&UART_INT_TXEMPTY);
+	}
+	if (inum==SIM_INUM_FRC1) {
+		//The timer counts down from the load value at 80MHz/16.
+		if (!(regs[(REG_FRC1_CTRL-REG_PERI_START)/4]&FRC1_ENABLE) || (int32_t)(sim_now()-frc1Next)<0) return 0;
+		frc1Next+=regs[(REG_FRC1_LOAD-REG_PERI_START)/4]/5+1;
+		return 1;
+	}
+	return 0;
+}
+
+void ets_wdt_disable(void) {
+}
+
+void ets_wdt_enable(void) {
+}
+
+
+//The flash is mapped at 0x40200000 like the cache does it, but only the first MB, as on the ESP.
+static void flashUpdate(uint32_t addr, uint32_t len) {
+	if (addr<0x100000) memcpy((void*)(uintptr_t)(SIM_FLASH_MAP+addr), flash+addr, (addr+len>0x100000)?0x100000-addr:len);
+	if (flashFd>=0) pwrite(flashFd, flash+addr, len, addr);
+}
+
+//Use a file as the flash, so what the program writes to it stays there after a reset.
+int sim_flash_file(const char *fn) {
+	flashFd=open(fn, O_RDWR|O_CREAT, 0644);
+	if (flashFd<0) return -1;
+	if (pread(flashFd, flash, SIM_FLASH_SIZE, 0)<0) return -1;
+	flashUpdate(0, SIM_FLASH_SIZE);
+	return 0;
+}
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec) {
+	if ((sec+1)*SPI_FLASH_SEC_SIZE>SIM_FLASH_SIZE) return SPI_FLASH_RESULT_ERR;
+	memset(flash+sec*SPI_FLASH_SEC_SIZE, 0xff, SPI_FLASH_SEC_SIZE);
+	flashUpdate(sec*SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+	sim_flash_erases++;
+	return SPI_FLASH_RESULT_OK;
+}
+
+//Like NOR flash, writing can only clear bits.
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size) {
+	unsigned char *s=(unsigned char*)src_addr;
+	uint32 i;
+	if ((des_addr&3) || des_addr+size>SIM_FLASH_SIZE) return SPI_FLASH_RESULT_ERR;
+	for (i=0; i<size; i++) flash[des_addr+i]&=s[i];
+	flashUpdate(des_addr, size);
+	sim_flash_writes++;
+	return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size) {
+	if ((src_addr&3) || src_addr+size>SIM_FLASH_SIZE) return SPI_FLASH_RESULT_ERR;
+	memcpy(des_addr, flash+src_addr, size);
+	return SPI_FLASH_RESULT_OK;
+}
+
+
+void os_install_putc1(void (*p)(char c)) {
+	putc1=p;
+}
+
+int sim_printf(const char *fmt, ...) {
+	char buf[256];
+	va_list ap;
+	int i, n;
+	va_start(ap, fmt);
+	n=vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	for (i=0; buf[i]!=0; i++) {
+		if (putc1!=NULL) putc1(buf[i]); else fputc(buf[i], stderr);
+	}
+	return n;
+}
+
+
+//The stub calls into ROM through function pointers. ROM isn't code here, so that faults; the reset
+//vector ends the simulation, anything else is a function we don't have.
+static void romCall(int sig, siginfo_t *si, void *ctx) {
+	uintptr_t addr=(uintptr_t)si->si_addr;
+	if (addr==ROM_RESET_VECTOR) {
+		fprintf(stderr, "gdbstub-host: reset\n");
+		simDone(2);
+	}
+	if (addr>=SIM_ROM_START && addr<SIM_ROM_START+0x10000) {
+		fprintf(stderr, "gdbstub-host: ROM function at 0x%lx isn't simulated\n", (unsigned long)addr);
+		abort();
+	}
+	signal(SIGSEGV, SIG_DFL);
+}
+
+void sim_init() {
+	struct sigaction sa;
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+	if (mmap((void*)SIM_DPORT_START, SIM_ROM_START-SIM_DPORT_START, PROT_READ|PROT_WRITE,
+				MAP_FIXED|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)==MAP_FAILED ||
+			mmap((void*)SIM_ROM_START, 0x300000, PROT_READ|PROT_WRITE,
+				MAP_FIXED|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)==MAP_FAILED) {
+		perror("gdbstub-host: mmap");
+		exit(1);
+	}
+	memset(flash, 0xff, sizeof(flash));
+	flashUpdate(0, 0x100000);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction=romCall;
+	//No SA_RESETHAND: we may longjmp out of the handler, and it has to stay installed.
+	sa.sa_flags=SA_SIGINFO|SA_NODEFER;
+	sigaction(SIGSEGV, &sa, NULL);
+}
@@ -0,0 +1,66 @@
+#ifndef SIM_H
+#define SIM_H
+
+/*
+The simulated ESP8266 the host build of gdbstub runs on. sim.c has the hardware: the memory map, the
+register file, UART0, the flash and the interrupt controller. target.c has the CPU and the program it
+runs, and the gdbstub entry points the assembly in gdbstub-entry.S provides on the real thing.
+*/
+
+#include <stdint.h>
+#include <setjmp.h>
+
+//Memory, mapped at the same addresses as on the ESP8266. Gdbstub uses 32-bit addresses, so the host
+//binary has to be built without PIE.
+#define SIM_DPORT_START	0x3ff00000		//DPORT/WDEV registers and DRAM, up to 0x40000000
+#define SIM_DRAM_START	0x3ffe8000
+#define SIM_ROM_START	0x40000000		//ROM, IRAM and the first MB of flash, up to 0x40300000
+#define SIM_IRAM_START	0x40100000
+#define SIM_IRAM_END	0x40108000
+#define SIM_FLASH_MAP	0x40200000
+#define SIM_FLASH_SIZE	(4*1024*1024)
+
+void sim_init();
+
+//UART0. With an fd, the UART is connected to it (a pty or stdin/stdout); -1 keeps what's sent in
+//memory, for tests. Call sim_uart_flush to push out what the stub sent.
+void sim_uart_open(int infd, int outfd);
+int sim_uart_open_pty(char *name, int len);
+void sim_uart_flush();
+void sim_uart_rx(const void *data, int len);
+int sim_uart_tx(void *buf, int len);
+int sim_uart_rx_pending();
+int sim_uart_wait(int ms);
+//In memory mode, called when the stub waits for a char that isn't there. It returns non-zero if it
+//added some; if it doesn't, the stub would wait forever, so the simulation longjmps to sim_done, or
+//exits if that isn't set.
+extern int (*sim_uart_refill)(void);
+extern jmp_buf *sim_done;
+
+//A TCP link to gdb, for gdbstub_set_transport. sim_tcp_listen listens on a port on localhost (0 picks a
+//free one) and returns it, or -1; the stub waits for gdb to connect the first time it waits for a packet.
+//While the program runs, sim_tcp_wait checks for a control-C.
+struct gdbstub_transport;
+extern const struct gdbstub_transport sim_tcp_transport;
+int sim_tcp_listen(int port);
+int sim_tcp_wait(int ms);
+
+//Interrupts the stub attached, and the UART/timer interrupt lines.
+#define SIM_INUM_UART	5
+#define SIM_INUM_FRC1	9
+typedef void (*sim_isr_t)(void *arg, void *frame);
+sim_isr_t sim_isr(int inum, void **arg);
+int sim_int_pending(int inum);
+
+//Flash operations done so far, and the file that backs the flash, if any.
+extern int sim_flash_erases, sim_flash_writes;
+int sim_flash_file(const char *fn);
+
+//Microseconds since sim_init; what WDEV_NOW returns.
+uint32_t sim_now();
+
+//Target (target.c)
+void sim_target_init();
+int sim_run(long count);
+
+#endif
@@ -0,0 +1,218 @@
+/*
+The simulated lx106 CPU for the host build, and the gdbstub entry points gdbstub-entry.S has on the real
+thing. The CPU only knows the handful of instructions the program below uses, plus BREAK and BREAK.N so
+software breakpoints work; anything else is skipped over. Watchpoints are accepted but never hit,
+because nothing is loaded or stored.
+
+Gdbstub is included rather than linked, so the tests can get at its internals.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gdbstub.c"
+#include "sim.h"
+
+//The program: a loop that counts in a2. gdbstub_do_break is a BREAK followed by a RET.N, as in
+//gdbstub-entry.S.
+#define PROG_DO_BREAK	SIM_IRAM_START
+#define PROG_START		(SIM_IRAM_START+0x100)
+#define PROG_STACK		0x3fffc000
+
+static const unsigned char prog[]={
+	0x1a, 0x22,						//loop: addi.n a2, a2, 1
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0xf0, 0x20, 0x00,				//nop
+	0x86, 0xf8, 0xff,				//j loop
+};
+static const unsigned char progDoBreak[]={
+	0x00, 0x40, 0x00,				//break 0, 0
+	0x0d, 0xf0,						//ret.n
+};
+
+static struct XTensa_exception_frame_s cpu;
+static int icountArmed;
+static uint32_t ibreakAddr, dbreakAddr;
+static int ibreakEna, dbreakEna;
+static uint32_t excCause;
+static void (*excHandler[64])(struct XTensa_exception_frame_s *frame);
+
+void* gdbstub_do_break_breakpoint_addr=(void*)PROG_DO_BREAK;
+
+static uint32_t *cpuReg(int n) {
+	if (n==0) return &cpu.a0;
+	if (n==1) return &cpu.a1;
+	return &cpu.a[n-2];
+}
+
+//Take a debug exception. The real entry code saves every register in gdbstub_savedRegs and
+//restores them from there.
+static void cpuDebug(int reason) {
+	gdbstub_savedRegs=cpu;
+	gdbstub_savedRegs.reason=reason;
+	gdbstub_handle_debug_exception();
+	cpu=gdbstub_savedRegs;
+}
+
+//Exceptions and interrupts get the registers the Xtensa HAL saves in a frame on the stack.
+static struct XTensa_exception_frame_s *cpuFrame() {
+	struct XTensa_exception_frame_s *frame=(void*)(uintptr_t)(cpu.a1-EXCEPTION_GDB_SP_OFFSET);
+	memcpy(frame, &cpu, 19*4);
+	return frame;
+}
+
+static void cpuException(int cause) {
+	struct XTensa_exception_frame_s *frame;
+	if (excHandler[cause]==NULL) {
+		fprintf(stderr, "gdbstub-host: unhandled exception %d at 0x%x\n", cause, cpu.pc);
+		exit(1);
+	}
+	excCause=cause;
+	frame=cpuFrame();
+	excHandler[cause](frame);
+	memcpy(&cpu, frame, 19*4);
+}
+
+static void cpuInterrupt(int inum) {
+	struct XTensa_exception_frame_s *frame;
+	void *arg;
+	sim_isr_t isr=sim_isr(inum, &arg);
+	if (isr==NULL || !sim_int_pending(inum)) return;
+	frame=cpuFrame();
+	isr(arg, frame);
+	memcpy(&cpu, frame, 19*4);
+}
+
+//Run the instruction at the PC.
+static void cpuStep() {
+	unsigned char *i=(unsigned char*)(uintptr_t)cpu.pc;
+	int32_t off;
+	if (ibreakEna && cpu.pc==ibreakAddr) {
+		cpuDebug(0x2);
+		return;
+	}
+	if ((i[0]&0x0f)>=8) {
+		//Narrow instruction
+		if (i[0]==0x2d && (i[1]&0xf0)==0xf0) {
+			cpuDebug(0x10);
+			return;
+		} else if (i[0]==0x0d && i[1]==0xf0) {
+			cpu.pc=cpu.a0;							//ret.n
+		} else if ((i[0]&0x0f)==0x0a) {
+			*cpuReg(i[1]>>4)=*cpuReg(i[1]&0xf)+((i[0]>>4)?(i[0]>>4):-1);	//addi.n
+			cpu.pc+=2;
+		} else {
+			cpu.pc+=2;
+		}
+	} else {
+		if (i[0]==0 && i[1]==0 && i[2]==0) {
+			cpuException(EXCCAUSE_ILLEGAL);			//ill
+			return;
+		} else if ((i[0]&0x0f)==0 && (i[1]&0xf0)==0x40 && i[2]==0) {
+			cpuDebug(0x8);
+			return;
+		} else if (i[0]==0x80 && i[1]==0 && i[2]==0) {
+			cpu.pc=cpu.a0;							//ret
+		} else if ((i[0]&0x3f)==0x06) {
+			off=(int32_t)((i[0]|(i[1]<<8)|(i[2]<<16))<<8);	//j
+			cpu.pc+=4+(off>>14);
+		} else {
+			cpu.pc+=3;
+		}
+	}
+	if (icountArmed) {
+		icountArmed=0;
+		cpuDebug(0x1);
+	}
+}
+
+//Run count instructions, or forever if count is negative. Interrupts are taken when PS.INTLEVEL is 0,
+//which it isn't while the stub single-steps.
+int sim_run(long count) {
+	long n;
+	for (n=0; count<0 || n<count; n++) {
+		//Don't spin: this checks for input and, if there's none, waits a bit.
+		if ((n&0x3fff)==0x3fff) {
+			sim_uart_wait(1);
+			sim_tcp_wait(1);
+		}
+		if ((cpu.ps&0xf)==0) {
+			cpuInterrupt(SIM_INUM_UART);
+			cpuInterrupt(SIM_INUM_FRC1);
+		}
+		cpuStep();
+	}
+	return 0;
+}
+
+void sim_target_init() {
+	memcpy((void*)PROG_DO_BREAK, progDoBreak, sizeof(progDoBreak));
+	memcpy((void*)PROG_START, prog, sizeof(prog));
+	memset(&cpu, 0, sizeof(cpu));
+	cpu.pc=PROG_START;
+	cpu.ps=0x20;
+	cpu.a0=PROG_START;
+	cpu.a1=PROG_STACK;
+}
+
+
+//What gdbstub-entry.S does on the ESP8266.
+void gdbstub_init_debug_entry() {
+}
+
+void gdbstub_do_break() {
+	cpu.a0=cpu.pc;
+	cpu.pc=PROG_DO_BREAK;
+}
+
+void gdbstub_icount_ena_single_step() {
+	icountArmed=1;
+}
+
+void gdbstub_save_extra_sfrs_for_exception() {
+	gdbstub_savedRegs.litbase=0;
+	gdbstub_savedRegs.sr176=0;
+	gdbstub_savedRegs.sr208=0;
+	gdbstub_savedRegs.reason=excCause;
+}
+
+void gdbstub_uart_entry() {
+}
+
+void gdbstub_prof_entry() {
+}
+
+int gdbstub_set_hw_breakpoint(int addr, int len) {
+	if (ibreakEna) return 0;
+	ibreakAddr=addr;
+	ibreakEna=1;
+	return 1;
+}
+
+int gdbstub_del_hw_breakpoint(int addr) {
+	if (!ibreakEna || ibreakAddr!=addr) return 0;
+	ibreakEna=0;
+	return 1;
+}
+
+int gdbstub_set_hw_watchpoint(int addr, int len, int type) {
+	if (dbreakEna) return 0;
+	dbreakAddr=addr;
+	dbreakEna=1;
+	return 1;
+}
+
+int gdbstub_del_hw_watchpoint(int addr) {
+	if (!dbreakEna || dbreakAddr!=addr) return 0;
+	dbreakEna=0;
+	return 1;
+}
+
+void _xtos_set_exception_handler(int cause, void (exhandler)(struct XTensa_exception_frame_s *frame)) {
+	excHandler[cause]=exhandler;
+}
@@ -0,0 +1,60 @@
+//Core dump: a fatal exception without gdb attached writes the registers and DRAM to flash and resets.
+//tools/gdbstub-coredump.py has to turn that into an ELF core file with the same registers and memory.
+#include <elf.h>
+#include <signal.h>
+#include "target.c"
+#include "rsp.h"
+
+#define DUMP "tests/coredump.bin"
+#define CORE "tests/coredump.core"
+#define MARK_ADDR 0x3fff0000
+#define MARK "core dump test"
+
+static unsigned char dump[GDBSTUB_COREDUMP_SIZE];
+static unsigned char core[2*GDBSTUB_COREDUMP_SIZE];
+
+int main() {
+	FILE *f;
+	Elf32_Ehdr *eh=(Elf32_Ehdr*)core;
+	Elf32_Phdr *ph;
+	uint32_t *gregs=NULL;
+	int i, n, found=0;
+	rspStart();
+
+	//Crash the program: put an ILL instruction in its loop.
+	strcpy((char*)MARK_ADDR, MARK);
+	cpu.a[1]=0x12345678;
+	memset((void*)(PROG_START+2), 0, 3);
+	rspWait(16);
+	CHECK(rspEnded==2);
+	CHECK(sim_flash_erases==GDBSTUB_COREDUMP_SIZE/SPI_FLASH_SEC_SIZE);
+
+	spi_flash_read(GDBSTUB_COREDUMP_ADDR, (uint32*)dump, sizeof(dump));
+	f=fopen(DUMP, "wb");
+	fwrite(dump, 1, sizeof(dump), f);
+	fclose(f);
+	CHECK(system("python3 ../tools/gdbstub-coredump.py " DUMP " " CORE)==0);
+	f=fopen(CORE, "rb");
+	CHECK(f!=NULL);
+	if (f==NULL) return 1;
+	n=fread(core, 1, sizeof(core), f);
+	fclose(f);
+
+	CHECK(n>sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG)==0);
+	CHECK(eh->e_type==ET_CORE && eh->e_machine==EM_XTENSA);
+	for (i=0; i<eh->e_phnum; i++) {
+		ph=(Elf32_Phdr*)(core+eh->e_phoff+i*eh->e_phentsize);
+		if (ph->p_type==PT_NOTE) {
+			//One NT_PRSTATUS note named "CORE"; the signal is at 12 in the descriptor, the registers at 72.
+			CHECK(*(uint32_t*)(core+ph->p_offset+8)==NT_PRSTATUS);
+			CHECK(*(uint16_t*)(core+ph->p_offset+20+12)==SIGILL);
+			gregs=(uint32_t*)(core+ph->p_offset+20+72);
+		} else if (ph->p_type==PT_LOAD && ph->p_vaddr<=MARK_ADDR && ph->p_vaddr+ph->p_filesz>MARK_ADDR) {
+			found=(memcmp(core+ph->p_offset+MARK_ADDR-ph->p_vaddr, MARK, sizeof(MARK))==0);
+		}
+	}
+	CHECK(gregs!=NULL && gregs[0]==PROG_START+2);
+	CHECK(gregs!=NULL && gregs[64+1]==PROG_STACK && gregs[64+3]==0x12345678);
+	CHECK(found);
+	return rspFailed;
+}
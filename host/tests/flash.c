@@ -0,0 +1,64 @@
+//Flash programming with vFlashErase/vFlashWrite/vFlashDone, the way gdb 'load' does it: sectors that
+//already hold the right data aren't erased and written again.
+#include "target.c"
+#include "rsp.h"
+
+#define ADDR 0x40210000
+#define SECTORS 8
+#define CHUNK 400						//Gdb sends what fits in a packet, escaped
+
+static unsigned char image[SECTORS*SPI_FLASH_SEC_SIZE];
+
+//Load the image, erasing eraseSectors sectors first. Returns the sectors erased and written.
+static void load(int eraseSectors, int *erased, int *written) {
+	char pkt[1024], *r;
+	int i, n, e=sim_flash_erases, w=sim_flash_writes;
+	sprintf(pkt, "vFlashErase:%x,%x", ADDR, eraseSectors*SPI_FLASH_SEC_SIZE);
+	rspExpect(pkt, "OK");
+	for (i=0; i<sizeof(image); i+=CHUNK) {
+		n=sprintf(pkt, "vFlashWrite:%x:", ADDR+i);
+		memcpy(pkt+n, image+i, (sizeof(image)-i<CHUNK)?sizeof(image)-i:CHUNK);
+		rspSendBin(pkt, n+((sizeof(image)-i<CHUNK)?sizeof(image)-i:CHUNK));
+		r=rspWait(16);
+		CHECK(r!=NULL && strcmp(r, "OK")==0);
+	}
+	rspExpect("vFlashDone", "OK");
+	*erased=sim_flash_erases-e;
+	*written=sim_flash_writes-w;
+	CHECK(memcmp((void*)ADDR, image, sizeof(image))==0);
+}
+
+int main() {
+	uint32_t data[4]={1, 2, 3, 4};
+	unsigned char ff[SPI_FLASH_SEC_SIZE];
+	int i, erased, written;
+	char *r;
+	for (i=0; i<sizeof(image); i++) image[i]=rand();
+	memset(ff, 0xff, sizeof(ff));
+	rspStart();
+	rspWait(0);
+	r=rspCmd("qXfer:memory-map:read::0,fff");
+	CHECK(r!=NULL && strstr(r, "<memory type=\"flash\" start=\"0x40200000\"")!=NULL);
+
+	//First load writes every sector; loading the same thing again writes none.
+	load(SECTORS, &erased, &written);
+	CHECK(erased==SECTORS && written==SECTORS);
+	load(SECTORS, &erased, &written);
+	CHECK(erased==0 && written==0);
+
+	//Change a byte: only its sector gets rewritten.
+	image[5*SPI_FLASH_SEC_SIZE+123]^=0x55;
+	load(SECTORS, &erased, &written);
+	CHECK(erased==1 && written==1);
+
+	//A sector gdb erases but doesn't write ends up erased.
+	spi_flash_write(ADDR-SIM_FLASH_MAP+sizeof(image), data, sizeof(data));
+	load(SECTORS+1, &erased, &written);
+	CHECK(erased==1 && written==1);
+	CHECK(memcmp((void*)(ADDR+sizeof(image)), ff, sizeof(ff))==0);
+
+	//Outside of the flash, and not sector-aligned
+	rspExpect("vFlashErase:40100000,1000", "E01");
+	rspExpect("vFlashErase:40210800,1000", "E01");
+	return rspFailed;
+}
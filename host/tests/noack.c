@@ -0,0 +1,43 @@
+//QStartNoAckMode: after gdb switches acks off, a single step costs fewer bytes and half the round trips.
+#include "target.c"
+#include "rsp.h"
+
+#define STEPS 20
+
+struct cost {
+	long bytes, trips, acks;
+};
+
+static struct cost steps() {
+	struct cost c;
+	long bytes=rspBytesOut+rspBytesIn, trips=rspTrips, acks=rspAcks;
+	char *r;
+	int i;
+	for (i=0; i<STEPS; i++) {
+		r=rspCmd("s");
+		CHECK(r!=NULL && strncmp(r, "T05", 3)==0);
+	}
+	c.bytes=rspBytesOut+rspBytesIn-bytes;
+	c.trips=rspTrips-trips;
+	c.acks=rspAcks-acks;
+	return c;
+}
+
+int main() {
+	struct cost ack, noack;
+	char *r;
+	rspStart();
+	rspWait(0);
+	r=rspCmd("qSupported:multiprocess+;swbreak+;hwbreak+;qRelocInsn+;fork-events+;vfork-events+;exec-events+;vContSupported+;QThreadEvents+;no-resumed+");
+	CHECK(r!=NULL && strstr(r, "QStartNoAckMode+")!=NULL);
+	ack=steps();
+	rspExpect("QStartNoAckMode", "OK");
+	rspNoAck=1;
+	noack=steps();
+	printf("per step: %.1f bytes, %.1f round trips with acks; %.1f bytes, %.1f round trips without\n",
+			(double)ack.bytes/STEPS, (double)ack.trips/STEPS, (double)noack.bytes/STEPS, (double)noack.trips/STEPS);
+	CHECK(ack.acks==STEPS && noack.acks==0);
+	CHECK(noack.bytes==ack.bytes-2*STEPS);
+	CHECK(noack.trips*2==ack.trips);
+	return rspFailed;
+}
@@ -0,0 +1,177 @@
+/*
+The gdb side of a session, for the tests. The simulated ESP8266 runs in its own context; whenever the
+stub waits for gdb (or every so many instructions while the program runs), it switches back here so the
+test can send the next packet. Tests of another transport set rspFd, and talk to a stub that runs in a
+process of its own over that. Include this after target.c.
+*/
+#include <ucontext.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define RSP_MAX 65536
+
+static ucontext_t rspTestCtx, rspSimCtx;
+//The stub's stack. It's a static so it's below 4G: the stub passes pointers to it around as 32 bits.
+static char rspSimStack[256*1024];
+static unsigned char rspIn[RSP_MAX];		//What the stub sent that isn't parsed yet
+static int rspInLen;
+static char rspReply[RSP_MAX];			//Payload of the last packet the stub sent
+static char rspConsole[RSP_MAX];			//Text of the O packets
+static int rspConsoleLen;
+static int rspNoAck;						//Gdb has switched off acks with QStartNoAckMode
+static int rspFd=-1;						//Talk to the stub over this socket instead of UART0
+static long rspBytesOut, rspBytesIn;		//Bytes gdb sent and got
+static long rspTrips;						//Times gdb waited for the stub: for the ack and for the answer to
+										//every packet, or only for the answer in no-ack mode
+static long rspAcks;						//Acks the stub sent
+static int rspFailed;
+static jmp_buf rspDone;
+static int rspEnded;						//Why the simulation ended, see sim_done: 1 out of input, 2 reset
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond); rspFailed=1; } } while(0)
+
+static int rspRefill(void) {
+	swapcontext(&rspSimCtx, &rspTestCtx);
+	return sim_uart_rx_pending();
+}
+
+static void rspSimMain(void) {
+	rspEnded=setjmp(rspDone);
+	if (rspEnded==0) {
+		sim_done=&rspDone;
+		gdbstub_init();
+		sim_run(-1);
+	}
+	while (1) swapcontext(&rspSimCtx, &rspTestCtx);
+}
+
+//Start the simulation and run until the stub waits for gdb.
+static void rspStart() {
+	sim_init();
+	sim_target_init();
+	sim_uart_refill=rspRefill;
+	getcontext(&rspSimCtx);
+	rspSimCtx.uc_stack.ss_sp=rspSimStack;
+	rspSimCtx.uc_stack.ss_size=sizeof(rspSimStack);
+	makecontext(&rspSimCtx, rspSimMain, 0);
+	swapcontext(&rspTestCtx, &rspSimCtx);
+}
+
+static void rspRaw(const void *data, int len) {
+	if (rspFd>=0) {
+		CHECK(write(rspFd, data, len)==len);
+	} else {
+		sim_uart_rx(data, len);
+	}
+	rspBytesOut+=len;
+}
+
+//Get what the stub sent over rspFd, waiting up to 10ms for something to come in.
+static int rspRecv(void *buf, int len) {
+	struct pollfd p={rspFd, POLLIN, 0};
+	int n;
+	if (poll(&p, 1, 10)<=0) return 0;
+	n=read(rspFd, buf, len);
+	return (n>0)?n:0;
+}
+
+//Find the next packet in what the stub sent, check it and decode it into rspReply. Returns 0 if there's
+//no complete packet yet.
+static int rspParse() {
+	int i, j, n=0;
+	unsigned char sum=0, c;
+	for (i=0; i<rspInLen && rspIn[i]!='$'; i++) ;
+	for (j=i+1; j<rspInLen && rspIn[j]!='#'; j++) ;
+	if (j+2>=rspInLen) return 0;
+	for (n=0; n<i; n++) {
+		if (rspIn[n]=='+') rspAcks++;
+	}
+	n=0;
+	for (i++; i<j; i++) {
+		c=rspIn[i];
+		sum+=c;
+		if (c=='}') {
+			sum+=rspIn[++i];
+			rspReply[n++]=rspIn[i]^0x20;
+		} else if (c=='*') {
+			sum+=rspIn[++i];
+			memset(rspReply+n, rspReply[n-1], rspIn[i]-29);
+			n+=rspIn[i]-29;
+		} else {
+			rspReply[n++]=c;
+		}
+	}
+	rspReply[n]=0;
+	CHECK(strtol((char[]){rspIn[j+1], rspIn[j+2], 0}, NULL, 16)==sum);
+	memmove(rspIn, rspIn+j+3, rspInLen-j-3);
+	rspInLen-=j+3;
+	if (!rspNoAck) rspRaw("+", 1);
+	return 1;
+}
+
+//Let the simulation run until the stub sent a packet that isn't console output, and return its
+//payload. Gives up and returns NULL after tries switches to the simulation, or 10ms waits for rspFd.
+static char *rspWait(int tries) {
+	int i;
+	while (1) {
+		if (rspFd>=0) {
+			i=rspRecv(rspIn+rspInLen, sizeof(rspIn)-rspInLen);
+		} else {
+			i=sim_uart_tx(rspIn+rspInLen, sizeof(rspIn)-rspInLen);
+		}
+		rspInLen+=i;
+		rspBytesIn+=i;
+		while (rspParse()) {
+			if (rspReply[0]!='O' || strcmp(rspReply, "OK")==0) return rspReply;
+			for (i=1; rspReply[i]!=0 && rspReply[i+1]!=0; i+=2) {
+				rspConsole[rspConsoleLen++]=strtol((char[]){rspReply[i], rspReply[i+1], 0}, NULL, 16);
+			}
+		}
+		if (tries--==0) return NULL;
+		if (rspFd<0) swapcontext(&rspTestCtx, &rspSimCtx);
+	}
+}
+
+//Send a packet of len bytes.
+static void rspSendBin(const char *data, int len) {
+	unsigned char sum=0, c;
+	char buf[8];
+	int i;
+	rspRaw("$", 1);
+	for (i=0; i<len; i++) {
+		c=data[i];
+		if (c=='#' || c=='$' || c=='}' || c=='*') {
+			rspRaw("}", 1);
+			sum+='}';
+			c^=0x20;
+		}
+		rspRaw(&c, 1);
+		sum+=c;
+	}
+	sprintf(buf, "#%02x", sum);
+	rspRaw(buf, 3);
+	rspTrips+=rspNoAck?1:2;
+}
+
+//Send a command and return the answer, or NULL if there's none after running the program for a while.
+static char *rspCmd(const char *pkt) {
+	rspSendBin(pkt, strlen(pkt));
+	return rspWait(16);
+}
+
+//Like rspCmd, but check the answer.
+static void rspExpect(const char *pkt, const char *reply) {
+	char *r=rspCmd(pkt);
+	if (r==NULL || strcmp(r, reply)!=0) {
+		printf("%s: expected '%s', got '%s'\n", pkt, reply, r?r:"(nothing)");
+		rspFailed=1;
+	}
+}
+
+//Get register n (in 'g' packet order) from a 'g' reply.
+static uint32_t rspReg(const char *g, int n) {
+	uint32_t v=0;
+	int i;
+	for (i=3; i>=0; i--) v=(v<<8)|strtol((char[]){g[n*8+i*2], g[n*8+i*2+1], 0}, NULL, 16);
+	return v;
+}
@@ -0,0 +1,49 @@
+//A basic session on the simulated ESP8266: stopping, stepping, breakpoints, memory and control-C.
+#include "target.c"
+#include "rsp.h"
+
+int main() {
+	char *r;
+	uint32_t a2;
+	rspStart();
+	//GDBSTUB_BREAK_ON_INIT: the stub stops in gdbstub_do_break and tells gdb.
+	r=rspWait(0);
+	CHECK(r!=NULL && strncmp(r, "T05", 3)==0);
+	r=rspCmd("g");
+	CHECK(r!=NULL && rspReg(r, 16)==PROG_DO_BREAK);
+
+	//Stepping over the BREAK gets us back to the program.
+	r=rspCmd("s");
+	CHECK(r!=NULL && strstr(r, "10:00011040;")!=NULL);
+	r=rspCmd("g");
+	a2=rspReg(r, 2);
+	rspCmd("s");
+	r=rspCmd("g");
+	CHECK(rspReg(r, 2)==a2+1 && rspReg(r, 16)==PROG_START+2);
+
+	rspExpect("m40100100,5", "1a22f02000");
+	rspExpect("M40100400,2:1234", "OK");
+	rspExpect("m40100400,2", "1234");
+
+	//Software breakpoint, then hardware breakpoint
+	rspExpect("Z0,40100108,3", "OK");
+	//The BREAK is in memory, but reading it gives the original instruction.
+	CHECK(memcmp((void*)0x40100108, "\x00\x40\x00", 3)==0);
+	rspExpect("m40100108,3", "f02000");
+	rspExpect("m40100106,6", "2000f02000f0");
+	r=rspCmd("c");
+	CHECK(r!=NULL && strncmp(r, "T05swbreak:", 11)==0 && strstr(r, "10:08011040;")!=NULL);
+	rspExpect("z0,40100108,3", "OK");
+	rspExpect("Z1,40100105,3", "OK");
+	r=rspCmd("c");
+	CHECK(r!=NULL && strncmp(r, "T05hwbreak:", 11)==0 && strstr(r, "10:05011040;")!=NULL);
+	rspExpect("z1,40100105,3", "OK");
+
+	//Let it run, then stop it.
+	CHECK(rspCmd("c")==NULL);
+	rspRaw("\x03", 1);
+	r=rspWait(16);
+	CHECK(r!=NULL && strncmp(r, "T02", 3)==0);
+	rspExpect("D", "OK");
+	return rspFailed;
+}
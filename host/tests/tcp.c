@@ -0,0 +1,57 @@
+//The stub over another transport: the TCP one gdbstub-host -p uses. The stub runs in a child process;
+//attach, read registers and memory, then let the program run and stop it with control-C.
+#include "target.c"
+#include "rsp.h"
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+int main() {
+	struct sockaddr_in sa;
+	int port, pid, status;
+	char *r;
+	sim_init();
+	sim_target_init();
+	port=sim_tcp_listen(0);
+	CHECK(port>0);
+	pid=fork();
+	if (pid==0) {
+		gdbstub_set_transport(&sim_tcp_transport);
+		gdbstub_init();
+		sim_run(-1);
+		return 0;
+	}
+	rspFd=socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family=AF_INET;
+	sa.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	sa.sin_port=htons(port);
+	CHECK(connect(rspFd, (struct sockaddr*)&sa, sizeof(sa))==0);
+
+	//The stub stopped in gdbstub_do_break before we connected; it tells us when asked.
+	r=rspCmd("?");
+	CHECK(r!=NULL && strncmp(r, "T05", 3)==0);
+	r=rspCmd("g");
+	CHECK(r!=NULL && rspReg(r, 16)==PROG_DO_BREAK);
+	rspExpect("m40100100,5", "1a22f02000");
+
+	//Control-C while the program runs stops it right after the BREAK in gdbstub_do_break.
+	CHECK(rspCmd("c")==NULL);
+	rspRaw("\x03", 1);
+	r=rspWait(100);
+	CHECK(r!=NULL && strncmp(r, "T02", 3)==0 && strstr(r, "10:03001040;")!=NULL);
+	r=rspCmd("g");
+	CHECK(r!=NULL && rspReg(r, 0)>=PROG_START && rspReg(r, 0)<PROG_START+sizeof(prog));
+	//From there, the program goes on where it was.
+	rspExpect("Z0,40100100,2", "OK");
+	r=rspCmd("c");
+	CHECK(r!=NULL && strncmp(r, "T05swbreak:", 11)==0 && strstr(r, "10:00011040;")!=NULL);
+	rspExpect("z0,40100100,2", "OK");
+	rspExpect("D", "OK");
+
+	//The stub's side ends when we hang up.
+	close(rspFd);
+	CHECK(waitpid(pid, &status, 0)==pid && WIFEXITED(status) && WEXITSTATUS(status)==0);
+	return rspFailed;
+}
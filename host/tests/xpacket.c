@@ -0,0 +1,55 @@
+//Binary memory writes ('X' packets): the payload is }-escaped on the wire, and the stub has to undo that
+//both when it reads a command and when the packet comes in through the UART interrupt.
+#include "target.c"
+#include "rsp.h"
+
+#define ADDR 0x40100400
+
+//Send an X packet writing len bytes of data to addr.
+static char *xWrite(uint32_t addr, const unsigned char *data, int len, int claim) {
+	char pkt[1024];
+	int n=sprintf(pkt, "X%x,%x:", addr, claim);
+	memcpy(pkt+n, data, len);
+	rspSendBin(pkt, n+len);
+	return rspWait(16);
+}
+
+int main() {
+	unsigned char data[256];
+	char hex[600];
+	char *r;
+	int i;
+	for (i=0; i<256; i++) data[i]=255-i;
+	rspStart();
+	rspWait(0);
+
+	//Gdb probes for X support with an empty write.
+	rspExpect("X40100400,0:", "OK");
+
+	//Every byte value, including the ones that have to be escaped ('#', '$', '}', '*').
+	r=xWrite(ADDR, data, 256, 256);
+	CHECK(r!=NULL && strcmp(r, "OK")==0);
+	CHECK(memcmp((void*)ADDR, data, 256)==0);
+	for (i=0; i<256; i++) sprintf(hex+i*2, "%02x", data[i]);
+	r=rspCmd("m40100400,100");
+	CHECK(r!=NULL && strcmp(r, hex)==0);
+
+	//Unaligned, and ending in an escaped char
+	r=xWrite(ADDR+1, (unsigned char*)"a#$}*", 5, 5);
+	CHECK(r!=NULL && strcmp(r, "OK")==0);
+	CHECK(memcmp((void*)ADDR, "\xff" "a#$}*\xf9", 7)==0);
+
+	//Less data than the length says, and memory that can't be written
+	r=xWrite(ADDR, (unsigned char*)"abc", 3, 4);
+	CHECK(r!=NULL && strcmp(r, "E01")==0);
+	CHECK(memcmp((void*)ADDR, "\xff" "a#$", 4)==0);
+	r=xWrite(0x40000000, (unsigned char*)"abc", 3, 3);
+	CHECK(r!=NULL && strcmp(r, "E01")==0);
+
+	//While the program runs, packets are parsed by the UART interrupt. These bytes include escaped ones.
+	CHECK(rspCmd("c")==NULL);
+	r=xWrite(ADDR, data+0xd0, 16, 16);
+	CHECK(r!=NULL && strcmp(r, "OK")==0);
+	CHECK(memcmp((void*)ADDR, data+0xd0, 16)==0);
+	return rspFailed;
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""
+Convert a core dump the gdbstub wrote to flash (see GDBSTUB_COREDUMP_ADDR) into an ELF core file
+xtensa-lx106-elf-gdb can load. Read the dump from the flash first, e.g. for the default size:
+
+  esptool.py read_flash 0x100000 0x19000 dump.bin
+  gdbstub-coredump.py dump.bin core
+  xtensa-lx106-elf-gdb app.elf core
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x31444347			# 'GCD1'
+HDR_WORDS = 26				# magic, size, reason, regions, 22 registers in 'g' packet order
+
+EM_XTENSA = 94
+ET_CORE = 4
+PT_LOAD = 1
+PT_NOTE = 4
+NT_PRSTATUS = 1
+
+# Same exception-to-signal mapping as sendReason() in gdbstub.c
+EXCEPTION_SIGNAL = [4, 31, 11, 11, 2, 6, 8, 0, 6, 7, 0, 0, 7, 7, 7, 7]
+
+
+def parse_dump(data):
+	if len(data) < HDR_WORDS * 4:
+		raise ValueError("dump too short")
+	hdr = struct.unpack_from("<%dI" % HDR_WORDS, data, 0)
+	if hdr[0] != MAGIC:
+		raise ValueError("no core dump found (bad magic %08x)" % hdr[0])
+	size, reason, nregions = hdr[1], hdr[2], hdr[3]
+	if size > len(data):
+		raise ValueError("dump is truncated: need %d bytes, have %d" % (size, len(data)))
+	regs = hdr[4:]
+	regions = []
+	pos = HDR_WORDS * 4
+	for _ in range(nregions):
+		start, length = struct.unpack_from("<II", data, pos)
+		pos += 8
+		regions.append((start, data[pos:pos + length]))
+		pos += length
+	return reason, regs, regions
+
+
+def prstatus(reason, regs):
+	# Layout of the Linux elf_prstatus for Xtensa, which is what BFD expects: the signal is at offset 12,
+	# the registers (xtensa_elf_gregset_t, 128 words) at 72. The gregset has pc, ps, lbeg, lend, lcount,
+	# sar, windowstart, windowbase at the start, and the address registers from word 64 on.
+	if reason & 0x80:
+		cause = reason & 0x7f
+		sig = EXCEPTION_SIGNAL[cause] if cause < len(EXCEPTION_SIGNAL) else 11
+	else:
+		sig = 5
+	gregs = [0] * 128
+	gregs[0] = regs[16]			# pc
+	gregs[1] = regs[21]			# ps
+	gregs[5] = regs[17]			# sar
+	gregs[6] = 1				# windowstart
+	gregs[7] = 0				# windowbase
+	gregs[64:80] = regs[0:16]	# a0-a15
+	desc = bytearray(72)
+	struct.pack_into("<h", desc, 12, sig)
+	struct.pack_into("<I", desc, 24, 1)		# pid
+	desc += struct.pack("<128I", *gregs)
+	desc += bytes(4)						# pr_fpvalid
+	return bytes(desc)
+
+
+def note(name, ntype, desc):
+	name = name.encode() + b"\0"
+	out = struct.pack("<III", len(name), len(desc), ntype)
+	out += name + bytes(-len(name) % 4)
+	out += desc + bytes(-len(desc) % 4)
+	return out
+
+
+def make_core(reason, regs, regions):
+	notes = note("CORE", NT_PRSTATUS, prstatus(reason, regs))
+	nphdr = 1 + len(regions)
+	off = 52 + 32 * nphdr
+	phdrs = struct.pack("<8I", PT_NOTE, off, 0, 0, len(notes), 0, 0, 4)
+	body = notes
+	off += len(notes)
+	for start, mem in regions:
+		phdrs += struct.pack("<8I", PT_LOAD, off, start, start, len(mem), len(mem), 7, 4)
+		body += mem
+		off += len(mem)
+	ehdr = struct.pack("<4sBBBB8xHHIIIIIHHHHHH", b"\x7fELF", 1, 1, 1, 0,
+			ET_CORE, EM_XTENSA, 1, 0, 52, 0, 0x300, 52, 32, nphdr, 40, 0, 0)
+	return ehdr + phdrs + body
+
+
+def main():
+	ap = argparse.ArgumentParser(description="Convert a gdbstub flash core dump to an ELF core file.")
+	ap.add_argument("dump", help="contents of the core dump flash area")
+	ap.add_argument("core", help="ELF core file to write")
+	args = ap.parse_args()
+	with open(args.dump, "rb") as f:
+		data = f.read()
+	try:
+		reason, regs, regions = parse_dump(data)
+	except ValueError as e:
+		sys.exit("%s: %s" % (args.dump, e))
+	with open(args.core, "wb") as f:
+		f.write(make_core(reason, regs, regions))
+	print("pc=%08x reason=%02x, %d memory regions" % (regs[16], reason, len(regions)))
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+Turn the samples of the gdbstub profiler (GDBSTUB_PROFILE_SIZE) into a profile. Save the output of
+'monitor prof dump' to a file, e.g. with
+
+  (gdb) set logging file prof.txt
+  (gdb) set logging redirect on
+  (gdb) set logging enabled on
+  (gdb) monitor prof dump
+  (gdb) set logging enabled off
+
+and run
+
+  gdbstub-profile.py app.elf prof.txt              flat profile, like gprof -p, plus callers
+  gdbstub-profile.py --folded app.elf prof.txt     input for flamegraph.pl
+
+Addresses are resolved with nm from the Xtensa toolchain; use --nm if it isn't in the PATH.
+"""
+
+import argparse
+import bisect
+import collections
+import re
+import subprocess
+import sys
+
+LINE_RE = re.compile(r"^\s*([0-9a-fA-F]{8})\s+([0-9a-fA-F]{8})\s+(\d+)\s*$")
+
+
+class Symbols:
+	def __init__(self, nm, elf):
+		out = subprocess.run([nm, "-n", "-S", "--defined-only", elf], check=True,
+				stdout=subprocess.PIPE, universal_newlines=True).stdout
+		self.addrs = []
+		self.syms = []
+		for line in out.splitlines():
+			f = line.split()
+			if len(f) == 4 and f[2] in "TtWw":
+				self.addrs.append(int(f[0], 16))
+				self.syms.append((int(f[0], 16) + int(f[1], 16), f[3]))
+
+	def name(self, addr):
+		i = bisect.bisect_right(self.addrs, addr) - 1
+		if i >= 0 and addr < self.syms[i][0]:
+			return self.syms[i][1]
+		return "0x%08x" % addr
+
+
+def read_samples(fn):
+	samples = []
+	with open(fn) as f:
+		for line in f:
+			m = LINE_RE.match(line)
+			if m:
+				samples.append((int(m.group(1), 16), int(m.group(2), 16), int(m.group(3))))
+	return samples
+
+
+def main():
+	ap = argparse.ArgumentParser(description="Make a profile from 'monitor prof dump' output.")
+	ap.add_argument("--nm", default="xtensa-lx106-elf-nm", help="nm to use (default: %(default)s)")
+	ap.add_argument("--folded", action="store_true", help="write folded stacks for flamegraph.pl")
+	ap.add_argument("elf", help="ELF file of the program")
+	ap.add_argument("dump", help="saved output of 'monitor prof dump'")
+	args = ap.parse_args()
+
+	samples = read_samples(args.dump)
+	if not samples:
+		sys.exit("%s: no samples found" % args.dump)
+	syms = Symbols(args.nm, args.elf)
+
+	self_count = collections.Counter()
+	pairs = collections.Counter()
+	for pc, caller, count in samples:
+		func = syms.name(pc)
+		self_count[func] += count
+		# a0 is the return address, so it points just past the call; step back into the caller.
+		pairs[(syms.name(caller - 1), func)] += count
+
+	if args.folded:
+		for (caller, func), count in sorted(pairs.items()):
+			print("%s;%s %d" % (caller, func, count))
+		return
+
+	total = sum(self_count.values())
+	print("Flat profile, %d samples:\n" % total)
+	print("  %time   samples  function")
+	for func, count in self_count.most_common():
+		print("%7.2f %9d  %s" % (100.0 * count / total, count, func))
+	print("\nCallers:\n")
+	print("  %time   samples  caller -> function")
+	for (caller, func), count in pairs.most_common():
+		print("%7.2f %9d  %s -> %s" % (100.0 * count / total, count, caller, func))
+
+
+if __name__ == "__main__":
+	main()
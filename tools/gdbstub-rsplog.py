@@ -0,0 +1,400 @@
+#!/usr/bin/env python3
+"""
+Show what a gdb session cost on the wire, per gdb command, from the log gdb writes with
+'set remotelogfile' (gdbcmds already turns this on). For every kind of command it lists how many
+round trips to the stub it took, the bytes sent each way, and the nacks.
+
+  gdbstub-rsplog.py gdb_rsp_logfile.txt
+
+The log has no timestamps, so the time spent in the stub only shows up if the session measured it
+with GDBSTUB_STATS: put 'monitor stats reset' before and 'monitor stats' after the commands, and the
+command time the stub reports is added to those commands. To see if a change to the stub made things
+worse, run the same gdb script before and after the change and compare the two logs:
+
+  gdb -batch -x session.gdb app.elf && mv gdb_rsp_logfile.txt before.txt
+  ...
+  gdbstub-rsplog.py --baseline before.txt gdb_rsp_logfile.txt
+
+This exits with status 1 if any command takes more bytes, round trips or stub time per run than in
+the baseline, by more than --tolerance percent. Stub time is only counted as worse if it also went up
+by more than --slack microseconds, as it varies from run to run.
+
+With --replay, the gdb side of the log is sent again to a stub, and the new session is what gets
+reported. The command has to run a stub that talks over stdin and stdout, like the host build; every
+gdb command is measured with 'monitor stats', so that needs GDBSTUB_STATS. --record saves the new
+session as a log. host/traces has sessions to check the host build against this way:
+
+  gdbstub-rsplog.py --replay "host/gdbstub-host -s" --baseline host/traces/step.log host/traces/step.log
+"""
+
+import argparse
+import collections
+import os
+import re
+import select
+import shlex
+import subprocess
+import sys
+import time
+
+ESCAPES = {"\\": "\\", "b": "\b", "f": "\f", "n": "\n", "r": "\r", "t": "\t", "v": "\v"}
+# Things gdb writes in the log that aren't data from the serial port.
+EVENT_RE = re.compile(r"<(Timeout: \d+ seconds|Eof|Error)>")
+STUB_TIME_RE = re.compile(r"^Command time \(us\):\s*(\d+)", re.M)
+# Commands that are followed by an argument that says what they do.
+TWO_WORD = ("monitor", "target", "set", "show", "info", "maint", "maintenance")
+
+
+def unescape(s):
+	s = EVENT_RE.sub("", s)
+	out = []
+	i = 0
+	while i < len(s):
+		c = s[i]
+		if c == "\\" and i + 1 < len(s):
+			n = s[i + 1]
+			if n == "x" and i + 3 < len(s):
+				out.append(chr(int(s[i + 2:i + 4], 16)))
+				i += 4
+				continue
+			if n in ESCAPES:
+				out.append(ESCAPES[n])
+				i += 2
+				continue
+		out.append(c)
+		i += 1
+	return "".join(out)
+
+
+def escape(s):
+	"""Write data the way gdb does in its log."""
+	out = []
+	for c in s:
+		if c == "\\":
+			out.append("\\\\")
+		elif c in "\b\f\n\r\t\v":
+			out.append("\\" + "bfnrtv"["\b\f\n\r\t\v".index(c)])
+		elif ord(c) < 0x20 or ord(c) >= 0x7f:
+			out.append("\\x%02x" % ord(c))
+		else:
+			out.append(c)
+	return "".join(out)
+
+
+def command_key(cmd):
+	words = cmd.split()
+	if not words:
+		return "(empty)"
+	if words[0] in TWO_WORD and len(words) > 1:
+		return words[0] + " " + words[1]
+	return words[0]
+
+
+def decode_payload(p):
+	"""Undo the } escapes and the run-length encoding (x*n: n-29 more x's) of a packet payload."""
+	out = []
+	i = 0
+	while i < len(p):
+		c = p[i]
+		if c == "}" and i + 1 < len(p):
+			out.append(chr(ord(p[i + 1]) ^ 0x20))
+			i += 2
+		elif c == "*" and out and i + 1 < len(p):
+			out.append(out[-1][-1] * (ord(p[i + 1]) - 29))
+			i += 2
+		else:
+			out.append(c)
+			i += 1
+	return "".join(out)
+
+
+def packets(data):
+	"""Yield the decoded payloads of the $...#xx packets in data."""
+	pos = 0
+	while True:
+		start = data.find("$", pos)
+		if start < 0:
+			return
+		end = data.find("#", start)
+		if end < 0:
+			return
+		yield decode_payload(data[start + 1:end])
+		pos = end + 1
+
+
+PACKET_RE = re.compile(r"\$([^#]*)#..", re.S)
+
+
+def requests(data):
+	"""Count the packets and breaks in what gdb sent; each of them waits for an answer. Packet data can
+	have a raw ^C in it (X, vFlashWrite), which isn't a break."""
+	n = len(PACKET_RE.findall(data))
+	return n + PACKET_RE.sub("", data).count("\x03")
+
+
+def console_text(payloads):
+	"""Decode the O packets (console output, monitor replies) among the payloads."""
+	text = []
+	for p in payloads:
+		if p.startswith("O") and p != "OK" and len(p) % 2 == 1:
+			try:
+				text.append(bytes.fromhex(p[1:]).decode("latin-1"))
+			except ValueError:
+				pass
+	return "".join(text)
+
+
+class Stats:
+	def __init__(self):
+		self.runs = 0
+		self.round_trips = 0
+		self.bytes_out = 0
+		self.bytes_in = 0
+		self.pkts_in = 0
+		self.nacks = 0
+		self.stub_us = 0
+		self.timed_runs = 0
+
+	def per_run(self):
+		n = max(self.runs, 1)
+		r = {"bytes": (self.bytes_out + self.bytes_in) / n, "round trips": self.round_trips / n}
+		if self.timed_runs:
+			r["stub us"] = self.stub_us / self.timed_runs
+		return r
+
+
+def add_stub_time(stats, measured, reply):
+	"""Give the command time in a 'monitor stats' reply to the commands that were measured."""
+	m = STUB_TIME_RE.search(console_text(reply))
+	if not m or not measured:
+		return
+	if len(set(measured)) == 1:
+		st = stats[measured[0]]
+		st.timed_runs += len(measured)
+	else:
+		st = stats.setdefault("(several)", Stats())
+		st.timed_runs += 1
+	st.stub_us += int(m.group(1))
+
+
+def read_log(fn):
+	"""Return the records in a log as (kind, data): c for a gdb command, w and r for what gdb wrote and read."""
+	records = []
+	with open(fn, encoding="latin-1") as f:
+		for line in f:
+			line = line.rstrip("\n")
+			if len(line) < 2 or line[1] != " " or line[0] not in "cwr":
+				continue
+			kind, data = line[0], line[2:]
+			records.append((kind, data if kind == "c" else unescape(data)))
+	return records
+
+
+def write_log(fn, records):
+	with open(fn, "w", encoding="latin-1") as f:
+		for kind, data in records:
+			f.write("%s %s\n" % (kind, data if kind == "c" else escape(data)))
+
+
+def parse_records(records):
+	stats = collections.OrderedDict()
+	key = "(connect)"
+	measured = []		# commands since the last 'monitor stats reset'
+	reply = []			# payloads the stub sent for the current command
+	for kind, data in records:
+		if kind == "c":
+			if key == "monitor stats":
+				add_stub_time(stats, measured, reply)
+				measured = []
+			key = command_key(data)
+			if key == "monitor stats" and data.split()[2:3] == ["reset"]:
+				key = "monitor stats reset"
+				measured = []
+			elif key != "monitor stats":
+				measured.append(key)
+			reply = []
+			stats.setdefault(key, Stats()).runs += 1
+			continue
+		st = stats.setdefault(key, Stats())
+		if kind == "w":
+			st.bytes_out += len(data)
+			st.round_trips += requests(data)
+			st.nacks += PACKET_RE.sub("", data).count("-")
+		else:
+			st.bytes_in += len(data)
+			p = list(packets(data))
+			st.pkts_in += len(p)
+			reply.extend(p)
+	if key == "monitor stats":
+		add_stub_time(stats, measured, reply)
+	return stats
+
+
+def parse_log(fn):
+	return parse_records(read_log(fn))
+
+
+def make_packet(payload):
+	return "$%s#%02x" % (payload, sum(payload.encode("latin-1")) & 0xff)
+
+
+class Replay:
+	"""Play the gdb side of a session to a stub running as cmd, and keep a log of the new session."""
+
+	def __init__(self, cmd, timeout):
+		self.proc = subprocess.Popen(shlex.split(cmd), stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+		self.timeout = timeout
+		self.records = []
+		self.pending = ""
+		self.noack = False
+		# What the stub says before gdb connects (like the stop for GDBSTUB_BREAK_ON_INIT) is thrown away,
+		# as gdb does.
+		while self.read(self.timeout):
+			pass
+		self.pending = ""
+
+	def read(self, timeout):
+		r, _, _ = select.select([self.proc.stdout], [], [], timeout)
+		if not r:
+			return ""
+		data = os.read(self.proc.stdout.fileno(), 65536).decode("latin-1")
+		if not data:
+			raise EOFError("stub exited")
+		self.pending += data
+		return data
+
+	def send(self, data):
+		"""Send what gdb sent, and wait for an answer to every packet and break in it."""
+		self.records.append(("w", data))
+		self.proc.stdin.write(data.encode("latin-1"))
+		self.proc.stdin.flush()
+		if "$QStartNoAckMode#" in data:
+			self.noack = True
+		want = requests(data)
+		got = []
+		end = time.time() + self.timeout
+		while want > 0 and time.time() < end:
+			self.read(max(end - time.time(), 0))
+			m = PACKET_RE.search(self.pending)
+			while m:
+				# Console output isn't an answer.
+				payload = decode_payload(m.group(1))
+				if not payload.startswith("O") or payload == "OK":
+					want -= 1
+				got.append(self.pending[:m.end()])
+				self.pending = self.pending[m.end():]
+				m = PACKET_RE.search(self.pending)
+		got.append(self.pending)
+		self.pending = ""
+		if "".join(got):
+			self.records.append(("r", "".join(got)))
+
+	def command(self, cmd, writes):
+		self.records.append(("c", cmd))
+		for data in writes:
+			self.send(data)
+
+	def monitor(self, cmd):
+		"""Run a monitor command like gdb does."""
+		self.records.append(("c", "monitor " + cmd))
+		self.send(make_packet("qRcmd," + cmd.encode().hex()))
+		if not self.noack:
+			self.records.append(("w", "+"))
+			self.proc.stdin.write(b"+")
+			self.proc.stdin.flush()
+
+	def close(self):
+		self.proc.stdin.close()
+		self.proc.wait()
+
+
+def replay(records, cmd, timeout):
+	"""Replay the gdb commands in records, each between 'monitor stats reset' and 'monitor stats'."""
+	groups = []
+	for kind, data in records:
+		if kind == "c":
+			groups.append((data, []))
+		elif kind == "w":
+			if not groups:
+				groups.append(("(connect)", []))
+			groups[-1][1].append(data)
+	r = Replay(cmd, timeout)
+	try:
+		for cmd, writes in groups:
+			if command_key(cmd) == "monitor stats":
+				continue
+			r.monitor("stats reset")
+			r.command(cmd, writes)
+			r.monitor("stats")
+	finally:
+		r.close()
+	return r.records
+
+
+def print_stats(stats):
+	print("%-24s %5s %7s %10s %10s %7s %6s %10s" % ("command", "runs", "trips", "bytes out", "bytes in",
+			"pkts in", "nacks", "stub us"))
+	total = Stats()
+	for key, st in stats.items():
+		stub = "%d" % st.stub_us if st.timed_runs else "-"
+		print("%-24s %5d %7d %10d %10d %7d %6d %10s" % (key, st.runs, st.round_trips, st.bytes_out,
+				st.bytes_in, st.pkts_in, st.nacks, stub))
+		for a in ("runs", "round_trips", "bytes_out", "bytes_in", "pkts_in", "nacks"):
+			setattr(total, a, getattr(total, a) + getattr(st, a))
+	print("%-24s %5d %7d %10d %10d %7d %6d" % ("total", total.runs, total.round_trips, total.bytes_out,
+			total.bytes_in, total.pkts_in, total.nacks))
+
+
+def compare(base, new, tolerance, slack):
+	worse = []
+	for key, st in new.items():
+		# What 'monitor stats' sends depends on the counters, so it's not worth comparing.
+		if key not in base or key.startswith("monitor stats"):
+			continue
+		b, n = base[key].per_run(), st.per_run()
+		for what in n:
+			limit = b.get(what, 0) * (1 + tolerance / 100.0) + (slack if what == "stub us" else 0)
+			if what in b and n[what] > limit:
+				worse.append("%s: %s per run went from %.0f to %.0f" % (key, what, b[what], n[what]))
+	return worse
+
+
+def main():
+	ap = argparse.ArgumentParser(description="Show the serial traffic of a gdb session per command.")
+	ap.add_argument("--baseline", help="older log of the same session to compare against")
+	ap.add_argument("--tolerance", type=float, default=5,
+			help="percent a command may get worse before it counts (default: %(default)s)")
+	ap.add_argument("--slack", type=float, default=1000,
+			help="microseconds stub time may go up regardless of --tolerance (default: %(default)s)")
+	ap.add_argument("--replay", metavar="CMD", help="send the gdb side of the log to the stub CMD runs")
+	ap.add_argument("--record", metavar="FILE", help="with --replay, save the new session here")
+	ap.add_argument("--timeout", type=float, default=0.5,
+			help="with --replay, seconds to wait for an answer (default: %(default)s)")
+	ap.add_argument("log", help="log written by gdb's 'set remotelogfile'")
+	args = ap.parse_args()
+
+	records = read_log(args.log)
+	if args.replay:
+		try:
+			records = replay(records, args.replay, args.timeout)
+		except (OSError, EOFError) as e:
+			sys.exit("%s: %s" % (args.replay, e))
+		if args.record:
+			write_log(args.record, records)
+	stats = parse_records(records)
+	if not stats:
+		sys.exit("%s: no remote log records found" % args.log)
+	print_stats(stats)
+	if args.baseline:
+		worse = compare(parse_log(args.baseline), stats, args.tolerance, args.slack)
+		print()
+		if worse:
+			print("Worse than %s:" % args.baseline)
+			for w in worse:
+				print("  " + w)
+			sys.exit(1)
+		print("No regressions against %s." % args.baseline)
+
+
+if __name__ == "__main__":
+	main()